@@ -0,0 +1,199 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+const size_t POOL_SLAB_OBJECTS = 1024;      // objects per slab a Pool takes from the heap
+const size_t ARENA_BLOCK_SIZE  = 64 << 10;  // bytes per block an Arena takes from the heap
+const size_t ARENA_MAX_BLOCKS  = 4;         // largest allocation an Arena serves, in blocks
+
+/* Allocators for the editing and rendering paths:
+    1. Pool<T> hands out fixed-size slots carved from slabs of POOL_SLAB_OBJECTS. Freed
+       slots go on a free list and are reused first; slabs are only returned when the
+       pool is destroyed. Long sessions therefore settle at the peak number of live
+       objects instead of fragmenting the heap.
+    2. Arena is a bump allocator for data that only lives until the end of a frame.
+       reset() rewinds it but keeps its blocks, so once a frame's worth of blocks has
+       been allocated, later frames take nothing from the heap. It serves allocations of
+       at most ARENA_MAX_BLOCKS blocks: text that can be any length, such as a line, is
+       read through a fixed-size block rather than copied whole.
+    3. allocCounters() counts what both have done. heap_blocks only moves when a pool
+       or arena had to grow; in steady state it stays flat.
+*/
+
+namespace yano
+{
+    typedef struct AllocCounters {
+        std::atomic<uint64_t> pool_allocs{0};
+        std::atomic<uint64_t> pool_frees{0};
+        std::atomic<uint64_t> arena_allocs{0};
+        std::atomic<uint64_t> arena_resets{0};
+        std::atomic<uint64_t> heap_blocks{0};   // slabs and arena blocks taken from the heap
+        std::atomic<uint64_t> heap_bytes{0};
+    } AllocCounters;
+
+    inline AllocCounters &allocCounters() {
+        static AllocCounters counters;
+        return counters;
+    }
+
+    // counters are statistics; relaxed ordering is enough
+    inline void allocCount(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    template <typename T>
+    class Pool
+    {
+        public:
+            Pool() {}
+            ~Pool();
+            Pool(const Pool &) = delete;
+            Pool &operator=(const Pool &) = delete;
+
+            // uninitialized storage for one T
+            T   *allocate();
+            // give back storage from allocate(); the object must already be destroyed
+            void release(T *p);
+
+        private:
+            union Slot {
+                Slot *next;
+                alignas(T) unsigned char storage[sizeof(T)];
+            };
+
+            std::vector<Slot *>  m_slabs;
+            Slot                *m_free = nullptr;
+
+            void grow();
+    };
+
+    class Arena
+    {
+        public:
+            explicit Arena(size_t blockSize = ARENA_BLOCK_SIZE) : m_block_size(blockSize) {}
+            ~Arena();
+            Arena(const Arena &) = delete;
+            Arena &operator=(const Arena &) = delete;
+
+            // bytes that stay valid until reset(); more than ARENA_MAX_BLOCKS blocks aborts
+            void *allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+            template <typename T>
+            T    *allocArray(size_t count) { return (T *)allocate(count * sizeof(T), alignof(T)); }
+            // forget every allocation, keeping the regular blocks for the next frame;
+            // oversized one-off blocks are freed so a single huge frame does not pin memory
+            void  reset();
+
+        private:
+            typedef struct Block {
+                char   *data;
+                size_t  size;
+            } Block;
+
+            size_t              m_block_size;
+            std::vector<Block>  m_blocks;
+            size_t              m_current = 0;  // block being bumped
+            size_t              m_used = 0;     // bytes of it handed out
+    };
+};
+
+template <typename T>
+yano::Pool<T>::~Pool()
+{
+    for (Slot *slab : m_slabs)
+        free(slab);
+}
+
+template <typename T>
+T *
+yano::Pool<T>::allocate()
+{
+    if (m_free == nullptr) grow();
+    Slot *slot = m_free;
+    m_free = slot->next;
+    allocCount(allocCounters().pool_allocs);
+    return (T *)slot->storage;
+}
+
+template <typename T>
+void
+yano::Pool<T>::release(T *p)
+{
+    Slot *slot = (Slot *)p;
+    slot->next = m_free;
+    m_free = slot;
+    allocCount(allocCounters().pool_frees);
+}
+
+template <typename T>
+void
+yano::Pool<T>::grow()
+{
+    Slot *slab = (Slot *)malloc(POOL_SLAB_OBJECTS * sizeof(Slot));
+    if (slab == NULL) abort();
+    m_slabs.push_back(slab);
+    for (size_t i = 0; i < POOL_SLAB_OBJECTS; ++i)
+        slab[i].next = (i + 1 < POOL_SLAB_OBJECTS) ? &slab[i + 1] : m_free;
+    m_free = slab;
+    allocCount(allocCounters().heap_blocks);
+    allocCount(allocCounters().heap_bytes, POOL_SLAB_OBJECTS * sizeof(Slot));
+}
+
+yano::Arena::~Arena()
+{
+    for (Block &block : m_blocks)
+        free(block.data);
+}
+
+void *
+yano::Arena::allocate(size_t bytes, size_t align)
+{
+    allocCount(allocCounters().arena_allocs);
+    // a request this size would be a line or file copied whole, never frame scratch
+    if (bytes > ARENA_MAX_BLOCKS * m_block_size) abort();
+    for (;;) {
+        if (m_current < m_blocks.size()) {
+            Block &block = m_blocks[m_current];
+            size_t start = (m_used + align - 1) & ~(align - 1);
+            if (start + bytes <= block.size) {
+                m_used = start + bytes;
+                return block.data + start;
+            }
+            // try the next kept block before growing
+            ++m_current;
+            m_used = 0;
+            continue;
+        }
+
+        // oversized requests get a block of their own, freed again by reset()
+        size_t size = std::max(m_block_size, bytes + align);
+        char *data = (char *)malloc(size);
+        if (data == NULL) abort();
+        m_blocks.push_back({ data, size });
+        allocCount(allocCounters().heap_blocks);
+        allocCount(allocCounters().heap_bytes, size);
+    }
+}
+
+void
+yano::Arena::reset()
+{
+    size_t kept = 0;
+    for (Block &block : m_blocks) {
+        if (block.size > m_block_size)
+            free(block.data);
+        else
+            m_blocks[kept++] = block;
+    }
+    m_blocks.resize(kept);
+    m_current = 0;
+    m_used = 0;
+    allocCount(allocCounters().arena_resets);
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+/* Design of pw::Backend:
+    1. Everything the editor needs from a window: a BGRX framebuffer (drawable),
+       damage()/present()/scroll() to get it on screen, and fd() plus pollEvents()
+       for input. pw::Window implements it on an X connection; pw::Headless keeps
+       the framebuffer in memory and takes its keys from the caller, so the editor
+       can be driven and measured without a display.
+    2. drawable is the same layout either way, so writePPM() snapshots any backend.
+    3. pushKey() injects keys from a script or test on any backend. pollEvents()
+       delivers them after the keys the backend received itself.
+    4. Rows of drawable are stride pixels apart, which may be more than window_width:
+       the buffer keeps its capacity when the window shrinks. A window manager resize
+       only updates configuredSize(); the drawing thread calls resize() once it has
+       a frame of that size, so drawable never changes under it.
+    5. Backends that can keep glyphs themselves (pw::Window over XRender) report
+       hasGlyphs(). Text is then uploaded once per glyph and drawn by id with
+       drawGlyphs(), straight to what present() shows; drawable goes unused. The
+       others leave the defaults and the caller rasterizes into drawable instead.
+*/
+
+namespace pw
+{
+    typedef struct KeyEvent {
+        uint8_t   keycode;          // X keycode (xcb_keycode_t)
+        uint16_t  state;            // XCB_MOD_MASK_* bits held at the time
+    } KeyEvent;
+
+    // how long present() spent on each part of its work, in nanoseconds
+    typedef struct PresentTiming {
+        uint64_t  upload_ns;        // getting damaged pixels to the server
+        uint64_t  flush_ns;         // writing the requests to the connection
+    } PresentTiming;
+
+    class Backend
+    {
+        public:
+            virtual ~Backend() {}
+
+            virtual bool shouldClose() = 0;
+            // handle every queued event, appending key presses to keys in arrival order
+            virtual void pollEvents(std::vector<KeyEvent> &keys) = 0;
+            // readable when events may be waiting
+            virtual int  fd() = 0;
+
+            // record an area of drawable that has changed since the last present()
+            virtual void damage(int16_t  x,
+                                int16_t  y,
+                                uint16_t width,
+                                uint16_t height) = 0;
+            // show the damaged areas
+            virtual PresentTiming present() = 0;
+            // move the band of rows [y, y + height) by dy rows (negative is up), leaving the
+            // rows it uncovers stale for the caller to redraw and damage
+            virtual void scroll(int16_t  y,
+                                uint16_t height,
+                                int16_t  dy) = 0;
+
+            // queue a key for the next pollEvents(); any thread may call this
+            virtual void pushKey(const KeyEvent &key);
+
+            // the size the window system last gave the window
+            void configuredSize(uint16_t &width, uint16_t &height) {
+                uint32_t size = m_configured.load(std::memory_order_relaxed);
+                width = size >> 16;
+                height = size & 0xffff;
+            }
+            // drawing thread: make drawable width x height, reusing its memory when it is
+            // big enough. Pixel contents are undefined afterwards
+            virtual void resize(uint16_t width, uint16_t height) = 0;
+
+            // server-side text, decided when the backend is created
+            virtual bool hasGlyphs() { return false; }
+            // forget every glyph; the ones added next are width x height
+            virtual void resetGlyphs(uint16_t width, uint16_t height) {}
+            // glyph id is height rows of width coverage bytes (0 is background)
+            virtual void addGlyph(uint32_t id, const uint8_t *coverage) {}
+            // fill count cells from (x, y) with bg and draw the glyphs ids over it in fg
+            virtual void drawGlyphs(int16_t         x,
+                                    int16_t         y,
+                                    const uint32_t *ids,
+                                    uint32_t        count,
+                                    uint32_t        fg,
+                                    uint32_t        bg) {}
+            // fill an area with color, as drawGlyphs() does its background
+            virtual void fillGlyphArea(int16_t  x,
+                                       int16_t  y,
+                                       uint16_t width,
+                                       uint16_t height,
+                                       uint32_t color) {}
+
+            // write drawable as a binary PPM
+            bool writePPM(const char *path);
+
+            uint8_t            *drawable = nullptr;  // format [height][stride][4], BGRX
+            uint32_t            stride = 0;          // pixels from one row to the next
+            uint16_t            window_width = 0;
+            uint16_t            window_height = 0;
+
+        protected:
+            // for pollEvents(): append and forget the keys pushKey() queued
+            void takeInjected(std::vector<KeyEvent> &keys);
+            // record a size given by the window system
+            void configure(uint16_t width, uint16_t height) {
+                m_configured.store((uint32_t)width << 16 | height, std::memory_order_relaxed);
+            }
+
+        private:
+            std::atomic<uint32_t>  m_configured{0};
+            std::mutex             m_inject_lock;
+            std::vector<KeyEvent>  m_injected;
+    };
+};
+
+void
+pw::Backend::pushKey(const KeyEvent &key)
+{
+    std::lock_guard<std::mutex> lock(m_inject_lock);
+    m_injected.push_back(key);
+}
+
+void
+pw::Backend::takeInjected(std::vector<KeyEvent> &keys)
+{
+    std::lock_guard<std::mutex> lock(m_inject_lock);
+    keys.insert(keys.end(), m_injected.begin(), m_injected.end());
+    m_injected.clear();
+}
+
+bool
+pw::Backend::writePPM(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return false;
+
+    fprintf(file, "P6\n%u %u\n255\n", window_width, window_height);
+    std::vector<uint8_t> row(window_width * 3);
+    for (uint32_t y = 0; y < window_height; ++y) {
+        const uint8_t *src = drawable + (size_t)y * stride * 4;
+        for (uint32_t x = 0; x < window_width; ++x) {
+            row[x * 3 + 0] = src[x * 4 + 2];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 0];
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    return fclose(file) == 0;
+}
+
+#endif
@@ -0,0 +1,403 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "../headless.h"
+#include "../yano.h"
+
+// Benchmark suite for the editor as a whole, run on a headless backend so it needs no
+// display. Every result is one line "case metric value unit" (lines starting with '#'
+// are comments), printed and also written to the file named by the first argument.
+
+const uint16_t SCREEN_WIDTH  = 2560;
+const uint16_t SCREEN_HEIGHT = 1600;
+const char    *FONT_NAME     = "boxxy";
+const uint8_t  FONT_SCALE    = 3;
+const uint64_t TEXT_BYTES    = 4 << 20;    // the file most cases edit
+const uint64_t LOAD_BYTES    = 256 << 20;  // the file the load case opens
+const int      TYPED_KEYS    = 2000;
+const int      SPLIT_JOINS   = 1000;       // pairs of Return and Backspace
+const int      PAGE_FLIPS    = 200;
+const int      SCROLL_STEPS  = 500;
+const int      RESIZES       = 60;
+const uint64_t SOURCE_LINES  = 1000000;    // the C file the highlight case edits
+const uint64_t WRAP_BYTES    = 4 << 20;    // the one line the wrap case moves through
+const int      WRAP_MOVES    = 500;
+const uint64_t TAIL_BYTES    = 512 << 20;  // appended to the file the tail case follows
+const uint64_t TAIL_WRITE    = 1 << 20;    // bytes per write to it
+const int      LOAD_RUNS     = 9;
+const double   MIN_SECONDS   = 0.25;       // repeat the blit case at least this long
+
+static FILE *results = NULL;
+
+void
+report(const char *name, const char *metric, double value, const char *unit)
+{
+    printf("%s %s %.3f %s\n", name, metric, value, unit);
+    if (results) fprintf(results, "%s %s %.3f %s\n", name, metric, value, unit);
+}
+
+// p50, p99 and max of per-step times
+void
+reportTimes(const char *name, const yano::Histogram &h)
+{
+    report(name, "p50", h.percentile(0.5) / 1e3, "us");
+    report(name, "p99", h.percentile(0.99) / 1e3, "us");
+    report(name, "max", h.max() / 1e3, "us");
+}
+
+// words of random letters in 40-100 byte lines
+void
+writeText(const char *path, uint64_t bytes)
+{
+    FILE *out = fopen(path, "w");
+    if (out == NULL) exit(1);
+    srand(1);
+    for (uint64_t written = 0; written < bytes; ) {
+        int line = 40 + rand() % 60;
+        for (int i = 0; i < line; ++i)
+            fputc((rand() % 6 == 0) ? ' ' : 'a' + rand() % 26, out);
+        fputc('\n', out);
+        written += line + 1;
+    }
+    fclose(out);
+}
+
+void
+writeSource(const char *path, uint64_t lines)
+{
+    // comments, strings and keywords, so every grammar rule gets exercised
+    FILE *out = fopen(path, "w");
+    if (out == NULL) exit(1);
+    const char *block[] = {
+        "/* sum the values in",
+        "   [0, count) */",
+        "static int sum(const int *values, size_t count) {",
+        "    int total = 0;  // running",
+        "    for (size_t i = 0; i < count; ++i) total += values[i] * 0x10;",
+        "    printf(\"%d \\\"done\\\"\\n\", total);",
+        "    return total;",
+        "}",
+    };
+    for (uint64_t i = 0; i < lines; ++i)
+        fprintf(out, "%s\n", block[i % 8]);
+    fclose(out);
+}
+
+// one line of words mixing ASCII with 2, 3 and 4 byte UTF-8, and no newline
+void
+writeLongLine(const char *path, uint64_t bytes)
+{
+    FILE *out = fopen(path, "w");
+    if (out == NULL) exit(1);
+    const char *words[] = { "plain ", "h\u00e9llo ", "w\u00f6rld ", "\u2211 ", "\u65e5\u672c ", "\U0001f600 " };
+    srand(1);
+    for (uint64_t written = 0; written < bytes; ) {
+        const char *word = words[rand() % 6];
+        fputs(word, out);
+        written += strlen(word);
+    }
+    fclose(out);
+}
+
+typedef struct Session {
+    pw::Headless *screen;       // owned by yano
+    yano::Yano   *yano;
+} Session;
+
+Session
+openSession(const char *path)
+{
+    Session s;
+    s.screen = new pw::Headless(SCREEN_WIDTH, SCREEN_HEIGHT);
+    s.yano = new yano::Yano(s.screen, FONT_NAME, FONT_SCALE);
+    if (path && !s.yano->openFile(path)) exit(1);
+    s.yano->step();
+    return s;
+}
+
+// queue keys and time the step that handles them
+uint64_t
+timedStep(Session &s, std::initializer_list<pw::KeyEvent> keys)
+{
+    for (const pw::KeyEvent &key : keys)
+        s.screen->pushKey(key);
+    uint64_t start = yano::Metrics::now();
+    s.yano->step();
+    return yano::Metrics::now() - start;
+}
+
+// the keys that type a decimal number
+std::vector<pw::KeyEvent>
+digits(uint64_t n)
+{
+    std::string text = std::to_string(n);
+    std::vector<pw::KeyEvent> keys;
+    for (char c : text)
+        keys.push_back({ (uint8_t)((c == '0') ? ZERO : ONE + (c - '1')), 0 });
+    return keys;
+}
+
+// Ctrl+G to one-based line, in one step
+uint64_t
+gotoLine(Session &s, uint64_t line)
+{
+    s.screen->pushKey({ G, XCB_MOD_MASK_CONTROL });
+    for (const pw::KeyEvent &key : digits(line))
+        s.screen->pushKey(key);
+    return timedStep(s, { { RETURN, 0 } });
+}
+
+void
+benchBlit()
+{
+    yano::Font font;
+    if (!font.load("../config", FONT_NAME)) exit(1);
+    uint32_t cell_w = font.width() * FONT_SCALE, cell_h = font.height() * FONT_SCALE;
+    uint32_t cols = SCREEN_WIDTH / cell_w, lines = SCREEN_HEIGHT / cell_h;
+    std::vector<uint32_t> screen((size_t)SCREEN_WIDTH * SCREEN_HEIGHT);
+    pw::MaskExpander expander(font.width(), FONT_SCALE);
+
+    // a screen of printable ASCII, expanded from the font bitmaps every pass
+    auto start = std::chrono::steady_clock::now();
+    uint64_t glyphs = 0;
+    double elapsed = 0;
+    do {
+        for (uint32_t r = 0; r < lines; ++r)
+            for (uint32_t c = 0; c < cols; ++c) {
+                uint32_t glyph = font.glyph(' ' + (r * cols + c) % 95);
+                expander.blit(&screen[r * cell_h * SCREEN_WIDTH + c * cell_w], SCREEN_WIDTH,
+                              font.bitmap(glyph), font.height(), 0x005e81ac, 0x002e3440);
+            }
+        glyphs += cols * lines;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < MIN_SECONDS);
+    report("glyph_blit", "glyphs_per_s", glyphs / elapsed, "1/s");
+    report("glyph_blit", "pixels_per_s", glyphs * cell_w * cell_h / elapsed / 1e6, "MP/s");
+}
+
+void
+benchRedraw(const char *path)
+{
+    // alternating pages changes every cell on screen
+    Session s = openSession(path);
+    yano::Histogram times;
+    uint64_t pixels = s.screen->presentedPixels();
+    for (int i = 0; i < PAGE_FLIPS; ++i)
+        times.record(timedStep(s, { { (uint8_t)((i & 1) ? PRIOR : NEXT), 0 } }));
+    reportTimes("redraw", times);
+    report("redraw", "pixels_per_frame", (double)(s.screen->presentedPixels() - pixels) / PAGE_FLIPS, "px");
+    s.screen->writePPM("bench_frame.ppm");
+    delete s.yano;
+}
+
+void
+benchScroll(const char *path)
+{
+    // moving the cursor one row past the bottom scrolls the view by one row
+    Session s = openSession(path);
+    yano::Histogram times;
+    gotoLine(s, 1000);
+    for (int i = 1; i <= SCROLL_STEPS; ++i)
+        times.record(gotoLine(s, 1000 + i));
+    reportTimes("scroll_line", times);
+    delete s.yano;
+}
+
+void
+benchResize(const char *path)
+{
+    // a window manager dragging between the default size, 4K and an ultrawide
+    // 5120x1440, the last two past the 2^22 pixels one upload used to hold
+    const uint16_t sizes[][2] = { { SCREEN_WIDTH, SCREEN_HEIGHT }, { 3840, 2160 }, { 5120, 1440 } };
+    Session s = openSession(path);
+    yano::Histogram times;
+    for (int i = 0; i < RESIZES; ++i) {
+        const uint16_t *size = sizes[(i + 1) % 3];
+        s.screen->reconfigure(size[0], size[1]);
+        uint64_t start = yano::Metrics::now();
+        s.yano->step();
+        times.record(yano::Metrics::now() - start);
+    }
+    reportTimes("resize", times);
+    delete s.yano;
+}
+
+void
+benchTyping(const char *path)
+{
+    Session s = openSession(path);
+    gotoLine(s, 1000);
+    const uint8_t word[] = { T, H, E, SPACE, Q, U, I, C, K, SPACE };
+    yano::Histogram times;
+    uint64_t start = yano::Metrics::now();
+    for (int i = 0; i < TYPED_KEYS; ++i)
+        times.record(timedStep(s, { { word[i % sizeof(word)], 0 } }));
+    double seconds = (yano::Metrics::now() - start) / 1e9;
+    report("typing", "keys_per_s", TYPED_KEYS / seconds, "1/s");
+    reportTimes("typing", times);
+    // the editor's own keystroke-to-present measurement over the same keys
+    const yano::Histogram &latency = s.yano->metrics().stage(yano::STAGE_LATENCY);
+    report("typing", "latency_p50", latency.percentile(0.5) / 1e3, "us");
+    report("typing", "latency_p99", latency.percentile(0.99) / 1e3, "us");
+    delete s.yano;
+}
+
+void
+benchHighlight(const char *path)
+{
+    // type near the top of a large C file while the rest is lexed in the background;
+    // rows off screen must never hold up a key
+    Session s = openSession(path);
+    uint64_t start = yano::Metrics::now();
+    gotoLine(s, 1000);
+    const uint8_t word[] = { T, H, E, SPACE, Q, U, I, C, K, SPACE };
+    yano::Histogram times;
+    for (int i = 0; i < TYPED_KEYS; ++i)
+        times.record(timedStep(s, { { word[i % sizeof(word)], 0 } }));
+    reportTimes("highlight_typing", times);
+    while (s.yano->highlighting()) {
+        s.yano->eventLoop().dispatch(1);
+        s.yano->step();
+    }
+    report("highlight", "lines", SOURCE_LINES, "lines");
+    report("highlight", "complete", (yano::Metrics::now() - start) / 1e6, "ms");
+    delete s.yano;
+}
+
+void
+benchWrap(const char *path)
+{
+    // Down, End, Up and Home through one soft-wrapped 4MB line: moving by visual lines
+    // must not rescan the row, however far into it the cursor is
+    Session s = openSession(path);
+    yano::Histogram down, edges, up;
+    for (int i = 0; i < WRAP_MOVES; ++i)
+        down.record(timedStep(s, { { DOWN, 0 } }));
+    for (int i = 0; i < WRAP_MOVES; ++i)
+        edges.record(timedStep(s, { { (i % 2) ? HOME : END, 0 } }));
+    for (int i = 0; i < WRAP_MOVES; ++i)
+        up.record(timedStep(s, { { UP, 0 } }));
+    reportTimes("wrap_down", down);
+    reportTimes("wrap_home_end", edges);
+    reportTimes("wrap_up", up);
+    delete s.yano;
+}
+
+void
+benchTail(const char *path)
+{
+    // a log written a megabyte at a time while yano follows it from its end: each write
+    // is taken in, and the view scrolled to it, before the next one
+    Session s = openSession(path);
+    if (!s.yano->follow(true)) exit(1);
+    struct stat st;
+    if (stat(path, &st) == -1) exit(1);
+    uint64_t size = st.st_size;
+    while (s.yano->cursorOffset() < size) {
+        s.yano->eventLoop().dispatch(1);
+        s.yano->step();
+    }
+
+    std::string lines;
+    for (int i = 0; lines.size() < TAIL_WRITE; ++i)
+        lines += "2024-05-01 12:00:00.000 INFO request " + std::to_string(i) + " served in 3 ms\n";
+    FILE *log = fopen(path, "a");
+    if (log == NULL) exit(1);
+    yano::Histogram times;
+    uint64_t busy = 0;
+    for (uint64_t written = 0; written < TAIL_BYTES; written += lines.size()) {
+        fwrite(lines.data(), 1, lines.size(), log);
+        fflush(log);
+        size += lines.size();
+        uint64_t start = yano::Metrics::now();
+        while (s.yano->cursorOffset() < size)
+            s.yano->step();
+        uint64_t elapsed = yano::Metrics::now() - start;
+        times.record(elapsed);
+        busy += elapsed;
+    }
+    fclose(log);
+    report("tail", "ingest", TAIL_BYTES / (busy / 1e9) / (1 << 20), "MB/s");
+    reportTimes("tail_write", times);
+    delete s.yano;
+}
+
+void
+benchSplitJoin(const char *path)
+{
+    // Return at the start of a line splits it off and Backspace joins it again; both
+    // move every row below, so the rest of the screen is laid out again
+    Session s = openSession(path);
+    gotoLine(s, 1000);
+    yano::Histogram split, join;
+    for (int i = 0; i < SPLIT_JOINS; ++i) {
+        split.record(timedStep(s, { { RETURN, 0 } }));
+        join.record(timedStep(s, { { BACKSPACE, 0 } }));
+    }
+    reportTimes("line_split", split);
+    reportTimes("line_join", join);
+    delete s.yano;
+}
+
+void
+benchLoad(const char *path)
+{
+    // open and show the first screen; the line index finishes in the background
+    Session s = openSession(NULL);
+    yano::Histogram open_times;
+    for (int i = 0; i < LOAD_RUNS; ++i) {
+        uint64_t start = yano::Metrics::now();
+        if (!s.yano->openFile(path)) exit(1);
+        s.yano->step();
+        open_times.record(yano::Metrics::now() - start);
+    }
+    report("load", "bytes", LOAD_BYTES, "B");
+    reportTimes("load", open_times);
+    delete s.yano;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 1) {
+        results = fopen(argv[1], "w");
+        if (results == NULL) return 1;
+    }
+    printf("# case metric value unit\n");
+
+    const char *text_path = "bench_text.txt";
+    const char *load_path = "bench_load.txt";
+    const char *source_path = "bench_source.c";
+    const char *wrap_path = "bench_wrap.txt";
+    const char *tail_path = "bench_tail.log";
+    writeText(text_path, TEXT_BYTES);
+    writeText(load_path, LOAD_BYTES);
+    writeSource(source_path, SOURCE_LINES);
+    writeLongLine(wrap_path, WRAP_BYTES);
+    writeText(tail_path, TEXT_BYTES);
+
+    benchBlit();
+    benchRedraw(text_path);
+    benchScroll(text_path);
+    benchResize(text_path);
+    benchTyping(text_path);
+    benchHighlight(source_path);
+    benchWrap(wrap_path);
+    benchTail(tail_path);
+    benchSplitJoin(text_path);
+    benchLoad(load_path);
+
+    remove(text_path);
+    remove(load_path);
+    remove(source_path);
+    remove(wrap_path);
+    remove(tail_path);
+    if (results) fclose(results);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "../blit.h"
+
+// Micro-benchmark for the pixel kernels in blit.h: fills and glyph expansion across
+// every kernel set this CPU supports, reported in megapixels per second.
+
+const uint32_t SCREEN_WIDTH  = 2560;
+const uint32_t SCREEN_HEIGHT = 1600;
+const double   MIN_SECONDS   = 0.25;   // repeat each case at least this long
+
+template <typename F>
+double
+megapixelsPerSecond(uint64_t pixels_per_pass, F pass)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t passes = 0;
+    double elapsed = 0;
+    do {
+        pass();
+        ++passes;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < MIN_SECONDS);
+    return pixels_per_pass * passes / elapsed / 1e6;
+}
+
+int
+main()
+{
+    std::vector<uint32_t> screen(SCREEN_WIDTH * SCREEN_HEIGHT);
+    const uint32_t glyph_w = 6, glyph_h = 14;
+
+    // a checkerboard glyph so both colors are written
+    std::vector<uint32_t> rows(glyph_h);
+    for (uint32_t y = 0; y < glyph_h; ++y)
+        rows[y] = (y & 1) ? 0xa8000000 : 0x54000000;
+
+    printf("%-8s %-14s %12s\n", "kernels", "case", "MP/s");
+    for (const pw::Kernels *k : pw::availableKernels()) {
+        double fill = megapixelsPerSecond(screen.size(), [&]() {
+            k->fill(screen.data(), screen.size(), 0x002e3440);
+        });
+        printf("%-8s %-14s %12.1f\n", k->name, "fill", fill);
+
+        for (uint32_t scale = 1; scale <= 4; ++scale) {
+            std::vector<uint32_t> sel(glyph_w * scale);
+            for (uint32_t j = 0; j < sel.size(); ++j)
+                sel[j] = 1u << (31 - j / scale);
+
+            // one full screen of cells, expanding every scaled row (no row reuse)
+            uint32_t cell_w = glyph_w * scale, cell_h = glyph_h * scale;
+            uint32_t cols = SCREEN_WIDTH / cell_w, lines = SCREEN_HEIGHT / cell_h;
+            double expand = megapixelsPerSecond((uint64_t)cols * lines * cell_w * cell_h, [&]() {
+                for (uint32_t r = 0; r < lines; ++r)
+                    for (uint32_t c = 0; c < cols; ++c) {
+                        uint32_t *dst = &screen[r * cell_h * SCREEN_WIDTH + c * cell_w];
+                        for (uint32_t y = 0; y < cell_h; ++y)
+                            k->expand(dst + y * SCREEN_WIDTH, rows[y / scale], sel.data(),
+                                      cell_w, 0x005e81ac, 0x002e3440);
+                    }
+            });
+            char name[32];
+            snprintf(name, sizeof(name), "expand %ux", scale);
+            printf("%-8s %-14s %12.1f\n", k->name, name, expand);
+        }
+    }
+    return 0;
+}
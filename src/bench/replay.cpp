@@ -0,0 +1,269 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../headless.h"
+#include "../yano.h"
+
+// Replays recorded sessions (see replay.h) against the editor and fuzzes its editing
+// paths against a reference model.
+//
+//   bench_replay <session> [--file path] [--realtime] [--x] [--events path]
+//       Play a session through the headless backend, or an X window with --x, as
+//       fast as the editor handles it or at the recorded pace with --realtime. Prints
+//       "replay metric value unit" lines: per-batch latency and the final buffer
+//       checksum, so runs of different builds can be compared. --events writes
+//       "index time_us keycode latency_us" for every key.
+//   bench_replay --fuzz <iterations> [--seed n]
+//       Type random keys (text, Return, Backspace, Up/Down/Home/End, goto line) into
+//       an empty buffer, in a window narrow enough for lines to wrap, and check the
+//       text and cursor against a std::string after every batch. A divergence is
+//       saved as fuzz_failure.session for replaying.
+
+const uint16_t SCREEN_WIDTH  = 2560;
+const uint16_t SCREEN_HEIGHT = 1600;
+const char    *FONT_NAME     = "boxxy";
+const uint8_t  FONT_SCALE    = 3;
+const int      FUZZ_BATCHES  = 300;    // batches of keys per fuzz iteration
+const uint16_t FUZZ_WIDTH    = 80;     // a dozen cells, so typed lines wrap
+
+uint64_t
+fnv1a(const std::string &text)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : text)
+        h = (h ^ (uint8_t)c) * 0x100000001b3ull;
+    return h;
+}
+
+int
+replay(const char *session, const char *file, bool realtime, bool x, const char *eventsPath)
+{
+    std::vector<yano::ReplayEvent> events;
+    if (!yano::loadSession(session, events)) {
+        printf("Error: cannot read session %s.\n", session);
+        return 1;
+    }
+    FILE *out = NULL;
+    if (eventsPath && (out = fopen(eventsPath, "w")) == NULL) {
+        printf("Error: cannot write %s.\n", eventsPath);
+        return 1;
+    }
+
+    pw::Backend *backend;
+    if (x) backend = new pw::Window(SCREEN_WIDTH, SCREEN_HEIGHT, "yano replay", -1);
+    else   backend = new pw::Headless(SCREEN_WIDTH, SCREEN_HEIGHT);
+    yano::Yano editor(backend, FONT_NAME, FONT_SCALE);
+    if (file && !editor.openFile(file)) return 1;
+    editor.step();
+
+    // keys recorded in one batch are delivered in one batch
+    yano::Histogram latency;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < events.size(); ) {
+        size_t end = i;
+        while (end < events.size() && events[end].time_us == events[i].time_us)
+            backend->pushKey(events[end++].key);
+        if (realtime)
+            std::this_thread::sleep_until(start + std::chrono::microseconds(events[i].time_us));
+
+        uint64_t sent = yano::Metrics::now();
+        editor.step();
+        uint64_t ns = yano::Metrics::now() - sent;
+        latency.record(ns);
+        for ( ; out && i < end; ++i)
+            fprintf(out, "%zu %llu %u %.1f\n", i, (unsigned long long)events[i].time_us,
+                    events[i].key.keycode, ns / 1e3);
+        i = end;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (out) fclose(out);
+
+    printf("# replay metric value unit\n");
+    printf("replay events %zu keys\n", events.size());
+    printf("replay batches %llu batches\n", (unsigned long long)latency.count());
+    printf("replay seconds %.3f s\n", seconds);
+    printf("replay p50 %.3f us\n", latency.percentile(0.5) / 1e3);
+    printf("replay p99 %.3f us\n", latency.percentile(0.99) / 1e3);
+    printf("replay max %.3f us\n", latency.max() / 1e3);
+    printf("replay checksum %016llx fnv1a\n", (unsigned long long)editor.textChecksum());
+    printf("replay cursor %llu B\n", (unsigned long long)editor.cursorOffset());
+    return 0;
+}
+
+// what the editor should do with the fuzzed keys, on a plain string
+typedef struct Model {
+    std::string text;
+    size_t      cursor = 0;
+    size_t      goal = SIZE_MAX;    // column Up and Down keep to, once one is pressed
+
+    void type(char c) {
+        text.insert(cursor++, 1, c);
+        goal = SIZE_MAX;
+    }
+    void backspace() {
+        goal = SIZE_MAX;
+        if (cursor == 0) return;
+        text.erase(--cursor, 1);
+    }
+    // [start, end) of the line holding offset at
+    size_t lineStart(size_t at) { return (at == 0) ? 0 : text.rfind('\n', at - 1) + 1; }
+    size_t lineEnd(size_t at) { return std::min(text.find('\n', at), text.size()); }
+    // col of visual line segment of the line [start, end), wrapped at cols, clamped to
+    // the cell after its last character on the last visual line and the last cell before
+    void place(size_t start, size_t end, size_t segment, size_t col, size_t cols) {
+        size_t last = (end - start) / cols;
+        size_t limit = (segment == last) ? end - start - last * cols : cols - 1;
+        cursor = start + segment * cols + std::min(col, limit);
+    }
+    // one visual line down (up if !down), staying put at either end of the text
+    void moveLine(bool down, size_t cols) {
+        size_t start = lineStart(cursor), end = lineEnd(cursor);
+        size_t segment = (cursor - start) / cols;
+        if (goal == SIZE_MAX) goal = (cursor - start) % cols;
+        if (down && segment < (end - start) / cols) {
+            ++segment;
+        } else if (down && end < text.size()) {
+            start = end + 1;
+            end = lineEnd(start);
+            segment = 0;
+        } else if (!down && segment > 0) {
+            --segment;
+        } else if (!down && start > 0) {
+            end = start - 1;
+            start = lineStart(end);
+            segment = (end - start) / cols;
+        }
+        place(start, end, segment, goal, cols);
+    }
+    // the start or end of the cursor's visual line
+    void moveToEdge(bool end, size_t cols) {
+        size_t start = lineStart(cursor);
+        goal = SIZE_MAX;
+        place(start, lineEnd(cursor), (cursor - start) / cols, end ? SIZE_MAX : 0, cols);
+    }
+    // the start of one-based line, clamped to the text
+    void gotoLine(uint64_t line) {
+        goal = SIZE_MAX;
+        uint64_t row = (line > 0) ? line - 1 : 0;
+        size_t start = 0;
+        for (uint64_t r = 0; r < row; ++r) {
+            size_t next = text.find('\n', start);
+            if (next == std::string::npos) break;
+            start = next + 1;
+        }
+        cursor = start;
+    }
+} Model;
+
+int
+fuzz(int iterations, uint64_t seed)
+{
+    XToAscii ascii;
+    const uint8_t text_keys[] = { A, B, C, Q, W, E, ONE, ZERO, MINUS, SPACE, SPACE, PERIOD };
+
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        std::mt19937_64 rng(seed + iteration);
+        pw::Headless *screen = new pw::Headless(FUZZ_WIDTH, 400);
+        yano::Yano editor(screen, FONT_NAME, 1);
+        editor.step();
+        size_t cols = editor.wrapWidth();
+        Model model;
+        std::vector<yano::ReplayEvent> session;
+
+        for (int batch = 0; batch < FUZZ_BATCHES; ++batch) {
+            std::vector<pw::KeyEvent> keys;
+            int count = 1 + rng() % 4;
+            for (int k = 0; k < count; ++k) {
+                int kind = rng() % 100;
+                if (kind < 45) {
+                    uint8_t keycode = text_keys[rng() % sizeof(text_keys)];
+                    uint16_t state = (rng() % 4 == 0) ? XCB_MOD_MASK_SHIFT : 0;
+                    keys.push_back({ keycode, state });
+                    model.type(ascii.convert(keycode, state ? 1 : 0));
+                } else if (kind < 52) {
+                    keys.push_back({ RETURN, 0 });
+                    model.type('\n');
+                } else if (kind < 80) {
+                    keys.push_back({ BACKSPACE, 0 });
+                    model.backspace();
+                } else if (kind < 90) {
+                    bool down = rng() % 2;
+                    keys.push_back({ down ? DOWN : UP, 0 });
+                    model.moveLine(down, cols);
+                } else if (kind < 95) {
+                    bool end = rng() % 2;
+                    keys.push_back({ end ? END : HOME, 0 });
+                    model.moveToEdge(end, cols);
+                } else {
+                    // goto a line that may be past the end; 0 means the first line
+                    uint64_t line = rng() % 12;
+                    keys.push_back({ G, XCB_MOD_MASK_CONTROL });
+                    for (char c : std::to_string(line))
+                        keys.push_back({ (uint8_t)((c == '0') ? ZERO : ONE + (c - '1')), 0 });
+                    keys.push_back({ RETURN, 0 });
+                    model.gotoLine(line);
+                }
+            }
+            for (const pw::KeyEvent &key : keys) {
+                screen->pushKey(key);
+                session.push_back({ (uint64_t)batch, key });
+            }
+            editor.step();
+
+            if (editor.textChecksum() == fnv1a(model.text) && editor.cursorOffset() == model.cursor)
+                continue;
+            printf("fuzz: seed %llu diverged at batch %d (cursor %llu, expected %zu)\n",
+                   (unsigned long long)(seed + iteration), batch,
+                   (unsigned long long)editor.cursorOffset(), model.cursor);
+            FILE *out = fopen("fuzz_failure.session", "w");
+            if (out) {
+                fprintf(out, "# yano session: time_us keycode state\n");
+                for (const yano::ReplayEvent &e : session)
+                    fprintf(out, "%llu %u %u\n", (unsigned long long)e.time_us, e.key.keycode, e.key.state);
+                fclose(out);
+            }
+            return 1;
+        }
+    }
+    printf("fuzz iterations %d runs\n", iterations);
+    printf("fuzz batches %d batches\n", iterations * FUZZ_BATCHES);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *session = NULL, *file = NULL, *events = NULL;
+    bool realtime = false, x = false;
+    int fuzz_iterations = 0;
+    uint64_t seed = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        bool more = i + 1 < argc;
+        if (strcmp(argv[i], "--file") == 0 && more) file = argv[++i];
+        else if (strcmp(argv[i], "--events") == 0 && more) events = argv[++i];
+        else if (strcmp(argv[i], "--fuzz") == 0 && more) fuzz_iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && more) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--realtime") == 0) realtime = true;
+        else if (strcmp(argv[i], "--x") == 0) x = true;
+        else if (argv[i][0] != '-') session = argv[i];
+        else {
+            printf("Error: unknown option %s.\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (fuzz_iterations > 0) return fuzz(fuzz_iterations, seed);
+    if (session == NULL) {
+        printf("usage: bench_replay <session> [--file path] [--realtime] [--x] [--events path]\n"
+               "       bench_replay --fuzz <iterations> [--seed n]\n");
+        return 1;
+    }
+    return replay(session, file, realtime, x, events);
+}
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../search.h"
+
+// Benchmark for search.h: literal and regex search over a piece table made of a
+// memory-mapped file plus scattered edits, at each thread count, reported in GB/s.
+// The longline case runs a regex over a single line of LONG_LINE_BYTES.
+
+const uint64_t TEXT_BYTES  = 256 << 20;
+const int      EDITS       = 10000;     // small inserts, so the text is many pieces
+const double   MIN_SECONDS = 0.5;       // repeat each case at least this long
+const uint64_t LONG_LINE_BYTES = 16 << 20;
+
+double
+gigabytesPerSecond(yano::Search &search, yano::PieceTable &text, uint64_t bytes,
+                   const std::string &pattern, bool regex, size_t &matches)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t passes = 0;
+    double elapsed = 0;
+    do {
+        std::vector<yano::Match> found;
+        search.start(text, pattern, regex, nullptr);
+        search.wait();
+        search.poll(found);
+        matches = found.size();
+        ++passes;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < MIN_SECONDS);
+    return bytes * passes / elapsed / 1e9;
+}
+
+int
+main()
+{
+    // words of random letters, 60-100 byte lines
+    const char *path = "bench_search.txt";
+    FILE *out = fopen(path, "w");
+    if (out == NULL) return 1;
+    srand(1);
+    for (uint64_t written = 0; written < TEXT_BYTES; ) {
+        int line = 60 + rand() % 40;
+        for (int i = 0; i < line; ++i)
+            fputc((rand() % 6 == 0) ? ' ' : 'a' + rand() % 26, out);
+        fputc('\n', out);
+        written += line + 1;
+    }
+    fclose(out);
+
+    yano::PieceTable text;
+    text.open(path);
+    for (int i = 0; i < EDITS; ++i)
+        text.insert(rand() % text.length(), "edit", 4);
+    uint64_t bytes = text.length();
+
+    struct Case { const char *name; const char *pattern; bool regex; };
+    const Case cases[] = {
+        { "literal", "zqxjv",            false },
+        { "regex",   "qu[a-z]+ing",      true  },
+    };
+
+    printf("%-8s %-8s %12s %10s\n", "case", "threads", "GB/s", "matches");
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (const Case &c : cases) {
+        for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+            yano::ThreadPool pool(threads);
+            yano::Search search(pool);
+            size_t matches = 0;
+            double rate = gigabytesPerSecond(search, text, bytes, c.pattern, c.regex, matches);
+            printf("%-8s %-8u %12.2f %10zu\n", c.name, threads, rate, matches);
+        }
+    }
+
+    // one line is one chunk, so only a single thread can work on it
+    std::string line;
+    for (uint64_t i = 0; i < LONG_LINE_BYTES; ++i)
+        line += 'a' + rand() % 2;
+    line += "z\n";
+    yano::PieceTable long_text;
+    long_text.insert(0, line.data(), line.size());
+    yano::ThreadPool pool(1);
+    yano::Search search(pool);
+    size_t matches = 0;
+    double rate = gigabytesPerSecond(search, long_text, long_text.length(), "(a|b)*z", true, matches);
+    printf("%-8s %-8u %12.2f %10zu\n", "longline", 1, rate, matches);
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,218 @@
+#ifndef BLIT_H
+#define BLIT_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BLIT_X86
+#include <immintrin.h>
+#endif
+
+/* Pixel kernels for 32-bit BGRX framebuffers:
+    1. fill writes one color across a run of pixels.
+    2. expand turns a row of a 1-bit glyph into foreground/background pixels. The row is
+       a 32-bit word, most significant bit first, and each source pixel is repeated
+       scale times. Destination pixel j tests bit sel[j] = 1 << (31 - j / scale), so any
+       scale is a plain per-lane AND/compare/blend with no shuffles.
+    3. Each kernel has scalar, SSE2 and AVX2 versions; kernels() picks the widest the
+       CPU supports the first time it is called.
+*/
+
+namespace pw
+{
+    typedef struct Kernels {
+        const char *name;
+        void (*fill)(uint32_t *dst, uint32_t count, uint32_t color);
+        void (*expand)(uint32_t *dst, uint32_t bits, const uint32_t *sel, uint32_t count,
+                       uint32_t fg, uint32_t bg);
+    } Kernels;
+
+    // best kernels for this CPU
+    const Kernels &kernels();
+    // every kernel set this CPU can run, narrowest first (for benchmarking)
+    std::vector<const Kernels *> availableKernels();
+
+    void fillRect(uint32_t *dst,
+                  uint32_t  stride,   // pixels per row of dst
+                  uint32_t  width,
+                  uint32_t  height,
+                  uint32_t  color);
+
+    // draws 1-bit glyphs of a fixed width (at most 32) at a fixed scale
+    class MaskExpander
+    {
+        public:
+            MaskExpander(uint32_t width, uint32_t scale);
+
+            // rows holds one MSB-first word per glyph row; draws (height * scale) rows
+            void blit(uint32_t       *dst,
+                      uint32_t        stride,
+                      const uint32_t *rows,
+                      uint32_t        height,
+                      uint32_t        fg,
+                      uint32_t        bg) const;
+
+            uint32_t width() const { return m_sel.size(); }
+
+        private:
+            uint32_t               m_scale;
+            std::vector<uint32_t>  m_sel;     // bit tested by each destination pixel
+            const Kernels         *m_kernels;
+    };
+};
+
+static void
+fill_scalar(uint32_t *dst, uint32_t count, uint32_t color)
+{
+    for (uint32_t i = 0; i < count; ++i)
+        dst[i] = color;
+}
+
+static void
+expand_scalar(uint32_t *dst, uint32_t bits, const uint32_t *sel, uint32_t count,
+              uint32_t fg, uint32_t bg)
+{
+    for (uint32_t i = 0; i < count; ++i)
+        dst[i] = (bits & sel[i]) ? fg : bg;
+}
+
+#ifdef BLIT_X86
+static void
+fill_sse2(uint32_t *dst, uint32_t count, uint32_t color)
+{
+    __m128i c = _mm_set1_epi32(color);
+    uint32_t i = 0;
+    for ( ; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i *)(dst + i), c);
+    for ( ; i < count; ++i)
+        dst[i] = color;
+}
+
+static void
+expand_sse2(uint32_t *dst, uint32_t bits, const uint32_t *sel, uint32_t count,
+            uint32_t fg, uint32_t bg)
+{
+    __m128i b = _mm_set1_epi32(bits);
+    __m128i f = _mm_set1_epi32(fg);
+    __m128i g = _mm_set1_epi32(bg);
+    uint32_t i = 0;
+    for ( ; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(sel + i));
+        __m128i m = _mm_cmpeq_epi32(_mm_and_si128(b, s), s);
+        __m128i px = _mm_or_si128(_mm_and_si128(m, f), _mm_andnot_si128(m, g));
+        _mm_storeu_si128((__m128i *)(dst + i), px);
+    }
+    for ( ; i < count; ++i)
+        dst[i] = (bits & sel[i]) ? fg : bg;
+}
+
+__attribute__((target("avx2"))) static void
+fill_avx2(uint32_t *dst, uint32_t count, uint32_t color)
+{
+    __m256i c = _mm256_set1_epi32(color);
+    uint32_t i = 0;
+    for ( ; i + 8 <= count; i += 8)
+        _mm256_storeu_si256((__m256i *)(dst + i), c);
+    for ( ; i < count; ++i)
+        dst[i] = color;
+}
+
+__attribute__((target("avx2"))) static void
+expand_avx2(uint32_t *dst, uint32_t bits, const uint32_t *sel, uint32_t count,
+            uint32_t fg, uint32_t bg)
+{
+    __m256i b = _mm256_set1_epi32(bits);
+    __m256i f = _mm256_set1_epi32(fg);
+    __m256i g = _mm256_set1_epi32(bg);
+    uint32_t i = 0;
+    for ( ; i + 8 <= count; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(sel + i));
+        __m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(b, s), s);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_blendv_epi8(g, f, m));
+    }
+    // a half-width step keeps short glyph rows (e.g. 6 px at 2x) off the scalar path;
+    // written inline so it stays VEX-encoded and avoids an SSE/AVX transition stall
+    if (i + 4 <= count) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(sel + i));
+        __m128i m = _mm_cmpeq_epi32(_mm_and_si128(_mm256_castsi256_si128(b), s), s);
+        __m128i px = _mm_blendv_epi8(_mm256_castsi256_si128(g), _mm256_castsi256_si128(f), m);
+        _mm_storeu_si128((__m128i *)(dst + i), px);
+        i += 4;
+    }
+    for ( ; i < count; ++i)
+        dst[i] = (bits & sel[i]) ? fg : bg;
+}
+#endif
+
+static const pw::Kernels SCALAR_KERNELS = { "scalar", fill_scalar, expand_scalar };
+#ifdef BLIT_X86
+static const pw::Kernels SSE2_KERNELS   = { "sse2",   fill_sse2,   expand_sse2 };
+static const pw::Kernels AVX2_KERNELS   = { "avx2",   fill_avx2,   expand_avx2 };
+#endif
+
+std::vector<const pw::Kernels *>
+pw::availableKernels()
+{
+    std::vector<const Kernels *> sets = { &SCALAR_KERNELS };
+#ifdef BLIT_X86
+    sets.push_back(&SSE2_KERNELS);      // part of the x86-64 baseline
+    if (__builtin_cpu_supports("avx2"))
+        sets.push_back(&AVX2_KERNELS);
+#endif
+    return sets;
+}
+
+const pw::Kernels &
+pw::kernels()
+{
+    static const Kernels *best = availableKernels().back();
+    return *best;
+}
+
+void
+pw::fillRect(uint32_t *dst,
+             uint32_t  stride,
+             uint32_t  width,
+             uint32_t  height,
+             uint32_t  color)
+{
+    const Kernels &k = kernels();
+    // contiguous rows collapse into one long run
+    if (width == stride) {
+        k.fill(dst, width * height, color);
+        return;
+    }
+    for (uint32_t y = 0; y < height; ++y)
+        k.fill(dst + y * stride, width, color);
+}
+
+pw::MaskExpander::MaskExpander(uint32_t width, uint32_t scale)
+{
+    m_scale = scale;
+    m_sel.resize(width * scale);
+    for (uint32_t j = 0; j < width * scale; ++j)
+        m_sel[j] = 1u << (31 - j / scale);
+    m_kernels = &kernels();
+}
+
+void
+pw::MaskExpander::blit(uint32_t       *dst,
+                       uint32_t        stride,
+                       const uint32_t *rows,
+                       uint32_t        height,
+                       uint32_t        fg,
+                       uint32_t        bg) const
+{
+    uint32_t count = m_sel.size();
+    for (uint32_t y = 0; y < height; ++y) {
+        m_kernels->expand(dst, rows[y], m_sel.data(), count, fg, bg);
+        // the remaining scaled rows repeat the first
+        for (uint32_t i = 1; i < m_scale; ++i)
+            memcpy(dst + i * stride, dst, count * sizeof(uint32_t));
+        dst += m_scale * stride;
+    }
+}
+
+#endif
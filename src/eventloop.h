@@ -0,0 +1,203 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+const int MAX_EPOLL_EVENTS = 32;   // ready sources handled per wakeup
+
+/* Design of yano::EventLoop:
+    1. One epoll set for everything the editor thread waits on. While nothing is ready,
+       the thread sleeps in epoll_wait instead of waking on a fixed tick.
+    2. Sources are file descriptors with a callback: plain fds (the X connection,
+       inotify, ...), timers (timerfd) and wakeups other threads can trigger (eventfd).
+    3. The before-wait hook runs each time the loop is about to sleep, after every ready
+       source has been handled. Work that should happen once per batch of events, like
+       publishing a frame, goes there.
+*/
+
+namespace yano
+{
+    class EventLoop
+    {
+        public:
+            typedef std::function<void(uint32_t events)> Callback;
+
+            EventLoop();
+            ~EventLoop();
+
+            // watch fd for events (EPOLLIN, ...); the loop does not take ownership of fd
+            bool addFd(int fd, uint32_t events, Callback callback);
+            void removeFd(int fd);
+
+            // fire callback after delay, then every delay if repeat; returns the timer's
+            // id for removeTimer(), or -1
+            int  addTimer(std::chrono::nanoseconds delay, bool repeat, std::function<void()> callback);
+            void removeTimer(int id);
+
+            // callback runs on the loop's thread after any thread calls notify(id)
+            int  addWakeup(std::function<void()> callback);
+            void notify(int id);
+            void removeWakeup(int id) { removeTimer(id); }
+
+            void setBeforeWait(std::function<void()> hook) { m_before_wait = hook; }
+
+            // dispatch events until stop() is called
+            void run();
+            void stop() { m_running = false; }
+            // handle the sources that become ready within timeout ms (-1 waits for one),
+            // without the before-wait hook; for driving the loop from outside run()
+            void dispatch(int timeout);
+
+        private:
+            typedef struct Source {
+                Callback  callback;
+                bool      owned;        // close the fd on removal
+            } Source;
+
+            int                                               m_epoll;
+            bool                                              m_running = false;
+            std::unordered_map<int, std::shared_ptr<Source>>  m_sources;
+            std::function<void()>                             m_before_wait;
+
+            bool add(int fd, uint32_t events, Callback callback, bool owned);
+    };
+};
+
+yano::EventLoop::EventLoop()
+{
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll == -1) {
+        printf("Error: cannot create event loop.\n");
+        exit(1);
+    }
+}
+
+yano::EventLoop::~EventLoop()
+{
+    for (auto &entry : m_sources)
+        if (entry.second->owned) close(entry.first);
+    close(m_epoll);
+}
+
+bool
+yano::EventLoop::addFd(int fd, uint32_t events, Callback callback)
+{
+    return add(fd, events, callback, false);
+}
+
+void
+yano::EventLoop::removeFd(int fd)
+{
+    auto it = m_sources.find(fd);
+    if (it == m_sources.end()) return;
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, NULL);
+    if (it->second->owned) close(fd);
+    m_sources.erase(it);
+}
+
+int
+yano::EventLoop::addTimer(std::chrono::nanoseconds delay, bool repeat, std::function<void()> callback)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) return -1;
+
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = delay.count() / 1000000000;
+    spec.it_value.tv_nsec = delay.count() % 1000000000;
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1;      // zero would disarm the timer
+    if (repeat) spec.it_interval = spec.it_value;
+    timerfd_settime(fd, 0, &spec, NULL);
+
+    bool added = add(fd, EPOLLIN, [this, fd, repeat, callback](uint32_t) {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+        if (!repeat) removeTimer(fd);
+        callback();
+    }, true);
+    if (!added) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void
+yano::EventLoop::removeTimer(int id)
+{
+    removeFd(id);
+}
+
+int
+yano::EventLoop::addWakeup(std::function<void()> callback)
+{
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) return -1;
+
+    bool added = add(fd, EPOLLIN, [fd, callback](uint32_t) {
+        uint64_t count;
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) return;
+        callback();     // several notify() calls may collapse into one callback
+    }, true);
+    if (!added) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void
+yano::EventLoop::notify(int id)
+{
+    uint64_t one = 1;
+    if (write(id, &one, sizeof(one)) != sizeof(one)) return;  // already pending
+}
+
+void
+yano::EventLoop::run()
+{
+    m_running = true;
+    while (m_running) {
+        if (m_before_wait) m_before_wait();
+        if (!m_running) break;
+        dispatch(-1);
+    }
+}
+
+void
+yano::EventLoop::dispatch(int timeout)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int ready = epoll_wait(m_epoll, events, MAX_EPOLL_EVENTS, timeout);
+    // a stop() from one of the callbacks skips the rest of the batch
+    bool running = m_running;
+    for (int i = 0; i < ready && m_running == running; ++i) {
+        auto it = m_sources.find(events[i].data.fd);
+        if (it == m_sources.end()) continue;    // removed by an earlier callback
+        // hold a reference so a callback can remove its own source
+        std::shared_ptr<Source> source = it->second;
+        source->callback(events[i].events);
+    }
+}
+
+bool
+yano::EventLoop::add(int fd, uint32_t events, Callback callback, bool owned)
+{
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) == -1) return false;
+    m_sources[fd] = std::make_shared<Source>(Source{ callback, owned });
+    return true;
+}
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+const char     FONT_CACHE_MAGIC[4] = { 'Y', 'B', 'F', 'C' };
+const uint32_t FONT_CACHE_VERSION  = 2;
+const uint32_t UNICODE_LIMIT       = 0x110000;
+const uint32_t GLYPH_PAGE_SIZE     = 256;     // codepoints per page of the glyph table
+
+/* Design of yano::Font:
+    1. Fonts are Adobe .bdf files in <config>/fonts. The first load compiles one into a
+       binary cache, <config>/.glyphs/<name>.ybf; later loads just mmap the cache. The
+       cache is rebuilt when it is missing, from another version, or older than the .bdf.
+    2. Cache layout: a FontHeader, then one GlyphRecord per glyph sorted by codepoint,
+       then the bitmaps. Every bitmap is already placed in the font's bounding box:
+       bbox_h words per glyph, one per row, most significant bit = leftmost pixel.
+    3. Codepoint lookup is a two-level table built when the cache is mapped: the top
+       level picks a 256-entry page of glyph indices. Pages the font does not touch all
+       share one empty page, so sparse fonts cost 4 bytes per 256 codepoints of range.
+    4. Codepoints without a glyph draw the font's DEFAULT_CHAR, or '?' if it has none.
+*/
+
+namespace yano
+{
+    class Font
+    {
+        public:
+            Font();
+            ~Font();
+
+            // load <configDir>/fonts/<name>.bdf through its compiled cache
+            bool load(const std::string &configDir, const std::string &name);
+
+            uint32_t glyphCount() { return m_header->glyph_count; }
+            int      width()      { return m_header->bbox_w; }
+            int      height()     { return m_header->bbox_h; }
+            int      xoff()       { return m_header->xoff; }
+            int      yoff()       { return m_header->yoff; }
+
+            // glyph index for codepoint, or -1 if the font does not have it
+            int32_t find(uint32_t codepoint) {
+                if (codepoint >= UNICODE_LIMIT) return -1;
+                return m_page_data[m_pages[codepoint / GLYPH_PAGE_SIZE] + codepoint % GLYPH_PAGE_SIZE];
+            }
+            // glyph index for codepoint, substituting the fallback glyph when missing
+            uint32_t glyph(uint32_t codepoint) {
+                int32_t g = find(codepoint);
+                return (g < 0) ? m_fallback : g;
+            }
+            uint32_t codepoint(uint32_t glyph) { return m_records[glyph].codepoint; }
+            // height() rows of MSB-first bits
+            const uint32_t *bitmap(uint32_t glyph) { return m_bitmaps + m_records[glyph].bitmap; }
+
+        private:
+            typedef struct FontHeader {
+                char      magic[4];
+                uint32_t  version;
+                uint32_t  glyph_count;
+                int16_t   bbox_w;
+                int16_t   bbox_h;
+                int16_t   xoff;
+                int16_t   yoff;
+                int32_t   default_char;     // DEFAULT_CHAR property, or -1
+                uint32_t  records_offset;   // bytes from the start of the file
+                uint32_t  bitmaps_offset;
+            } FontHeader;
+
+            typedef struct GlyphRecord {
+                uint32_t  codepoint;
+                uint8_t   bbox_w;           // the glyph's own box, as given by BBX
+                uint8_t   bbox_h;
+                int8_t    xoff;
+                int8_t    yoff;
+                uint32_t  bitmap;           // index of the first row in the bitmap words
+            } GlyphRecord;
+
+            void               *m_map = nullptr;
+            size_t              m_map_size = 0;
+            const FontHeader   *m_header = nullptr;
+            const GlyphRecord  *m_records = nullptr;
+            const uint32_t     *m_bitmaps = nullptr;
+
+            std::vector<uint32_t>  m_pages;         // page start in m_page_data, per 256 codepoints
+            std::vector<int32_t>   m_page_data;     // page 0 is the shared empty page
+            uint32_t               m_fallback = 0;
+
+            void buildIndex();
+            bool map(const std::string &cachePath);
+            void unmap();
+            static bool compile(const std::string &bdfPath, const std::string &cachePath);
+    };
+};
+
+yano::Font::Font()
+{
+}
+
+yano::Font::~Font()
+{
+    unmap();
+}
+
+bool
+yano::Font::load(const std::string &configDir, const std::string &name)
+{
+    std::string bdfPath = configDir + "/fonts/" + name + ".bdf";
+    std::string cachePath = configDir + "/.glyphs/" + name + ".ybf";
+
+    struct stat bdf, cache;
+    bool have_bdf = stat(bdfPath.c_str(), &bdf) == 0;
+    bool fresh = stat(cachePath.c_str(), &cache) == 0 &&
+                 (!have_bdf || cache.st_mtime >= bdf.st_mtime);
+
+    if (fresh && map(cachePath)) return true;
+    if (!have_bdf) {
+        printf("Error: cannot find font %s.\n", bdfPath.c_str());
+        return false;
+    }
+
+    YANO_LOG("Compiling font cache %s.\n", cachePath.c_str());
+    mkdir((configDir + "/.glyphs").c_str(), 0755);
+    if (!compile(bdfPath, cachePath)) {
+        printf("Error: cannot compile font %s.\n", bdfPath.c_str());
+        return false;
+    }
+    return map(cachePath);
+}
+
+void
+yano::Font::buildIndex()
+{
+    m_pages.assign(UNICODE_LIMIT / GLYPH_PAGE_SIZE, 0);
+    m_page_data.assign(GLYPH_PAGE_SIZE, -1);
+
+    for (uint32_t g = 0; g < m_header->glyph_count; ++g) {
+        uint32_t cp = m_records[g].codepoint;
+        if (cp >= UNICODE_LIMIT) continue;
+        uint32_t &page = m_pages[cp / GLYPH_PAGE_SIZE];
+        if (page == 0) {
+            page = m_page_data.size();
+            m_page_data.resize(page + GLYPH_PAGE_SIZE, -1);
+        }
+        m_page_data[page + cp % GLYPH_PAGE_SIZE] = g;
+    }
+
+    int32_t fallback = (m_header->default_char >= 0) ? find(m_header->default_char) : -1;
+    if (fallback < 0) fallback = find('?');
+    m_fallback = (fallback < 0) ? 0 : fallback;
+}
+
+bool
+yano::Font::map(const std::string &cachePath)
+{
+    unmap();
+
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(FontHeader)) {
+        close(fd);
+        return false;
+    }
+    m_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m_map == MAP_FAILED) {
+        m_map = nullptr;
+        return false;
+    }
+    m_map_size = st.st_size;
+
+    // reject caches from other versions or that were cut short
+    const FontHeader *h = (const FontHeader *)m_map;
+    if (memcmp(h->magic, FONT_CACHE_MAGIC, 4) != 0 || h->version != FONT_CACHE_VERSION ||
+        h->records_offset + (uint64_t)h->glyph_count * sizeof(GlyphRecord) > m_map_size ||
+        h->bitmaps_offset + (uint64_t)h->glyph_count * h->bbox_h * sizeof(uint32_t) > m_map_size) {
+        unmap();
+        return false;
+    }
+
+    m_header = h;
+    m_records = (const GlyphRecord *)((const char *)m_map + h->records_offset);
+    m_bitmaps = (const uint32_t *)((const char *)m_map + h->bitmaps_offset);
+    buildIndex();
+    return true;
+}
+
+void
+yano::Font::unmap()
+{
+    if (m_map) munmap(m_map, m_map_size);
+    m_map = nullptr;
+    m_header = nullptr;
+}
+
+bool
+yano::Font::compile(const std::string &bdfPath, const std::string &cachePath)
+{
+    std::ifstream bdf(bdfPath);
+    if (!bdf.is_open()) return false;
+
+    FontHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FONT_CACHE_MAGIC, 4);
+    header.version = FONT_CACHE_VERSION;
+    header.default_char = -1;
+
+    std::vector<GlyphRecord> records;
+    std::vector<uint32_t> bitmaps;
+    GlyphRecord glyph;
+    int32_t encoding = -1;
+    int w = 0, h = 0, x = 0, y = 0, default_char;
+
+    std::string line;
+    while (std::getline(bdf, line)) {
+        if (sscanf(line.c_str(), "FONTBOUNDINGBOX %d %d %d %d", &w, &h, &x, &y) == 4) {
+            header.bbox_w = w;
+            header.bbox_h = h;
+            header.xoff = x;
+            header.yoff = y;
+        } else if (sscanf(line.c_str(), "DEFAULT_CHAR %d", &default_char) == 1) {
+            header.default_char = default_char;
+        } else if (sscanf(line.c_str(), "ENCODING %d", &encoding) == 1) {
+            continue;
+        } else if (sscanf(line.c_str(), "BBX %d %d %d %d", &w, &h, &x, &y) == 4) {
+            glyph.bbox_w = w;
+            glyph.bbox_h = h;
+            glyph.xoff = x;
+            glyph.yoff = y;
+        } else if (line.compare(0, 6, "BITMAP") == 0) {
+            // rows of the glyph's own box, placed inside the font box by their offsets
+            std::vector<uint32_t> rows(header.bbox_h, 0);
+            int top = (header.bbox_h + header.yoff) - (glyph.yoff + glyph.bbox_h);
+            int shift = glyph.xoff - header.xoff;
+            for (int r = 0; std::getline(bdf, line) && line.compare(0, 7, "ENDCHAR") != 0; ++r) {
+                int bytes = (line.size() / 2);
+                uint32_t bits = strtoul(line.c_str(), NULL, 16);
+                if (bytes < 4) bits <<= 8 * (4 - bytes);
+                if (top + r >= 0 && top + r < header.bbox_h && shift >= 0 && shift < 32)
+                    rows[top + r] = bits >> shift;
+            }
+            // unencoded glyphs (ENCODING -1) have no codepoint to be reached by
+            if (encoding >= 0) {
+                glyph.codepoint = encoding;
+                glyph.bitmap = bitmaps.size();
+                records.push_back(glyph);
+                bitmaps.insert(bitmaps.end(), rows.begin(), rows.end());
+            }
+            encoding = -1;
+        }
+    }
+    if (header.bbox_h <= 0 || header.bbox_w <= 0 || header.bbox_w > 32) return false;
+
+    std::sort(records.begin(), records.end(),
+              [](const GlyphRecord &a, const GlyphRecord &b) { return a.codepoint < b.codepoint; });
+    header.glyph_count = records.size();
+    header.records_offset = sizeof(FontHeader);
+    header.bitmaps_offset = header.records_offset + records.size() * sizeof(GlyphRecord);
+
+    // write beside the cache and rename, so a reader never maps a half-written file
+    std::string tmpPath = cachePath + ".tmp";
+    FILE *out = fopen(tmpPath.c_str(), "wb");
+    if (out == NULL) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(records.data(), sizeof(GlyphRecord), records.size(), out) == records.size() &&
+              fwrite(bitmaps.data(), sizeof(uint32_t), bitmaps.size(), out) == bitmaps.size();
+    ok = (fclose(out) == 0) && ok;
+    if (ok) ok = rename(tmpPath.c_str(), cachePath.c_str()) == 0;
+    if (!ok) unlink(tmpPath.c_str());
+    return ok;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/* Design of the render handoff:
+    1. The editor thread describes the screen as a yano::Frame, a grid of cells (a
+       codepoint plus attributes). It never touches pixels. Every row carries a hash of
+       its cells, so the render thread skips unchanged rows without comparing them.
+    2. A FrameMailbox moves finished frames to the render thread through three frame
+       buffers: the editor fills one, the render thread reads one, and the third sits
+       in m_ready. Publishing and acquiring are each a single atomic exchange, so
+       neither side ever waits on the other, and a frame is only seen once complete.
+    3. If the editor publishes twice before the render thread looks, the older frame
+       is simply replaced; the render thread always gets the newest one.
+    4. The mutex and condition variable are only used to let an idle render thread
+       sleep until a frame arrives; they are never held while frames are exchanged.
+*/
+
+const uint32_t ATTR_INVERSE     = 1;    // swap foreground and background (the cursor)
+const uint32_t ATTR_COLOR_SHIFT = 1;    // the bits above are an index into Frame::palette
+const uint32_t ATTR_COLORS      = 16;   // palette entries; 0 is the theme's foreground
+const uint32_t ATTR_COUNT       = ATTR_COLORS << ATTR_COLOR_SHIFT;  // distinct attribute values
+const uint64_t NO_HASH          = 0;    // rowHash() never returns this
+
+namespace yano
+{
+    typedef struct Cell {
+        uint32_t  codepoint;
+        uint32_t  attr;                         // ATTR_* bits
+
+        bool operator==(const Cell &other) const {
+            return codepoint == other.codepoint && attr == other.attr;
+        }
+        bool operator!=(const Cell &other) const { return !(*this == other); }
+    } Cell;
+
+    inline uint32_t attrColor(uint32_t attr) { return attr >> ATTR_COLOR_SHIFT; }
+
+    // FNV-1a over a row of cells
+    inline uint64_t rowHash(const Cell *cells, uint32_t count) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (uint32_t i = 0; i < count; ++i) {
+            h = (h ^ cells[i].codepoint) * 0x100000001b3ull;
+            h = (h ^ cells[i].attr) * 0x100000001b3ull;
+        }
+        return (h == NO_HASH) ? 1 : h;
+    }
+
+    typedef struct Frame {
+        uint16_t               rows;
+        uint16_t               cols;
+        std::vector<Cell>      cells;           // row-major
+        std::vector<uint64_t>  row_hash;        // rowHash() of each row of cells
+        int64_t                top;             // visual lines scrolled so far; only changes matter
+        int                    cursor_row;
+        int                    cursor_col;
+        uint8_t                font_scale;
+        uint16_t               width;           // window size the grid was laid out for
+        uint16_t               height;
+        uint32_t               palette[ATTR_COLORS];  // BGRX foreground per attrColor()
+        uint32_t               background;
+        uint64_t               input_time;      // Metrics::now() at the oldest key shown first here, or 0
+        uint64_t               publish_time;    // Metrics::now() when published
+    } Frame;
+
+    class FrameMailbox
+    {
+        public:
+            FrameMailbox();
+
+            // editor side: copy frame into the mailbox, replacing any unread frame
+            void publish(const Frame &frame);
+            // render side: the newest unread frame, or nullptr if nothing new arrived.
+            // The frame stays valid until the next acquire()
+            const Frame *acquire();
+            // render side: block until a frame is ready; false once close() was called
+            bool wait();
+            // wake the render thread for good
+            void close();
+            // editor side: whether the last published frame has not been acquired yet
+            bool pending() { return m_ready.load(std::memory_order_acquire) & FRESH; }
+
+        private:
+            static const uintptr_t FRESH = 1;   // tag on m_ready: not yet acquired
+
+            Frame                   m_frames[3];
+            Frame                  *m_back;     // owned by the editor thread
+            Frame                  *m_front;    // owned by the render thread
+            std::atomic<uintptr_t>  m_ready;    // the third frame, tagged with FRESH
+
+            std::mutex              m_wake_lock;
+            std::condition_variable m_wake;
+            bool                    m_closed = false;
+    };
+};
+
+yano::FrameMailbox::FrameMailbox()
+{
+    m_back = &m_frames[0];
+    m_front = &m_frames[1];
+    m_ready.store((uintptr_t)&m_frames[2]);
+}
+
+void
+yano::FrameMailbox::publish(const Frame &frame)
+{
+    *m_back = frame;    // reuses the buffer's storage once it has grown to size
+    uintptr_t previous = m_ready.exchange((uintptr_t)m_back | FRESH, std::memory_order_acq_rel);
+    m_back = (Frame *)(previous & ~FRESH);
+
+    // taking the lock orders this notify after a wait() that just checked m_ready
+    { std::lock_guard<std::mutex> lock(m_wake_lock); }
+    m_wake.notify_one();
+}
+
+const yano::Frame *
+yano::FrameMailbox::acquire()
+{
+    if (!(m_ready.load(std::memory_order_acquire) & FRESH)) return nullptr;
+    uintptr_t previous = m_ready.exchange((uintptr_t)m_front, std::memory_order_acq_rel);
+    m_front = (Frame *)(previous & ~FRESH);
+    return m_front;
+}
+
+bool
+yano::FrameMailbox::wait()
+{
+    std::unique_lock<std::mutex> lock(m_wake_lock);
+    m_wake.wait(lock, [this] { return m_closed || (m_ready.load() & FRESH); });
+    return !m_closed;
+}
+
+void
+yano::FrameMailbox::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wake_lock);
+        m_closed = true;
+    }
+    m_wake.notify_all();
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+/* Design of pw::Headless:
+    1. A Backend with no display. drawable is plain memory, present() only counts
+       what a window would have been sent, and scroll() moves pixels the same way
+       pw::Window does, so the editor renders exactly what it would on screen.
+    2. Keys only come from pushKey(), and resizes from reconfigure(). fd() is an
+       eventfd that is readable while either is pending, so run() works unchanged;
+       without run(), Yano::step() handles them on the calling thread.
+*/
+
+namespace pw
+{
+    class Headless : public Backend
+    {
+        public:
+            Headless(uint16_t width, uint16_t height);
+            ~Headless();
+
+            // also makes fd() readable
+            void pushKey(const KeyEvent &key) override;
+            // make shouldClose() true, as closing a window would
+            void close();
+            // change configuredSize(), as a window manager resizing the window would
+            void reconfigure(uint16_t width, uint16_t height);
+
+            bool shouldClose() override { return m_should_close; }
+            void pollEvents(std::vector<KeyEvent> &keys) override;
+            int  fd() override { return m_event_fd; }
+
+            void damage(int16_t  x,
+                        int16_t  y,
+                        uint16_t width,
+                        uint16_t height) override;
+            PresentTiming present() override;
+            void scroll(int16_t  y,
+                        uint16_t height,
+                        int16_t  dy) override;
+            void resize(uint16_t width, uint16_t height) override;
+
+            // what present() would have sent so far
+            uint64_t presents() { return m_presents; }
+            uint64_t presentedPixels() { return m_presented_pixels; }
+
+        private:
+            uint32_t               m_capacity_rows;
+            int                    m_event_fd;
+            std::atomic<bool>      m_should_close{false};
+
+            std::atomic<uint64_t>  m_damaged_pixels{0};  // since the last present()
+            std::atomic<uint64_t>  m_presents{0};
+            std::atomic<uint64_t>  m_presented_pixels{0};
+    };
+};
+
+pw::Headless::Headless(uint16_t width, uint16_t height)
+{
+    window_width = width;
+    window_height = height;
+    stride = width;
+    m_capacity_rows = height;
+    drawable = (uint8_t *)calloc((size_t)width * height, 4);
+    configure(width, height);
+    m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (drawable == NULL || m_event_fd == -1) {
+        printf("Error: cannot create headless framebuffer.\n");
+        exit(1);
+    }
+}
+
+pw::Headless::~Headless()
+{
+    ::close(m_event_fd);
+    free(drawable);
+}
+
+void
+pw::Headless::pushKey(const KeyEvent &key)
+{
+    Backend::pushKey(key);
+    uint64_t one = 1;
+    if (write(m_event_fd, &one, sizeof(one)) != sizeof(one)) {}
+}
+
+void
+pw::Headless::close()
+{
+    m_should_close = true;
+    uint64_t one = 1;
+    if (write(m_event_fd, &one, sizeof(one)) != sizeof(one)) {}
+}
+
+void
+pw::Headless::reconfigure(uint16_t width, uint16_t height)
+{
+    configure(width, height);
+    uint64_t one = 1;
+    if (write(m_event_fd, &one, sizeof(one)) != sizeof(one)) {}
+}
+
+void
+pw::Headless::pollEvents(std::vector<KeyEvent> &keys)
+{
+    uint64_t count;
+    if (read(m_event_fd, &count, sizeof(count)) != sizeof(count)) {}    // empty is fine
+    takeInjected(keys);
+}
+
+void
+pw::Headless::damage(int16_t  x,
+                     int16_t  y,
+                     uint16_t width,
+                     uint16_t height)
+{
+    int32_t x0 = std::max<int32_t>(x, 0);
+    int32_t y0 = std::max<int32_t>(y, 0);
+    int32_t x1 = std::min<int32_t>(x + width, window_width);
+    int32_t y1 = std::min<int32_t>(y + height, window_height);
+    if (x0 >= x1 || y0 >= y1) return;
+    m_damaged_pixels += (uint64_t)(x1 - x0) * (y1 - y0);
+}
+
+pw::PresentTiming
+pw::Headless::present()
+{
+    PresentTiming timing = { 0, 0 };
+    uint64_t pixels = m_damaged_pixels.exchange(0);
+    if (pixels == 0) return timing;
+    ++m_presents;
+    m_presented_pixels += pixels;
+    return timing;
+}
+
+void
+pw::Headless::scroll(int16_t  y,
+                     uint16_t height,
+                     int16_t  dy)
+{
+    int32_t y0 = std::max<int32_t>(y, 0);
+    int32_t y1 = std::min<int32_t>(y + height, window_height);
+    int32_t moved = (y1 - y0) - std::abs(dy);
+    if (moved <= 0) return;
+
+    int32_t from = (dy < 0) ? y0 - dy : y0;
+    int32_t to = from + dy;
+    size_t row_bytes = (size_t)stride * 4;
+    memmove(drawable + to * row_bytes, drawable + from * row_bytes, moved * row_bytes);
+}
+
+void
+pw::Headless::resize(uint16_t width, uint16_t height)
+{
+    if (width > stride || height > m_capacity_rows) {
+        uint32_t new_stride = std::max<uint32_t>(width, stride);
+        uint32_t new_rows = std::max<uint32_t>(height, m_capacity_rows);
+        free(drawable);
+        drawable = (uint8_t *)calloc((size_t)new_stride * new_rows, 4);
+        if (drawable == NULL) abort();
+        stride = new_stride;
+        m_capacity_rows = new_rows;
+    }
+    window_width = width;
+    window_height = height;
+    m_damaged_pixels = 0;
+}
+
+#endif
@@ -0,0 +1,716 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <dirent.h>
+
+#include "frame.h"
+#include "piecetable.h"
+
+const uint32_t HIGHLIGHT_SYNC_LINES      = 1024;       // lines lexed on the editor thread before the thread takes over
+const uint32_t HIGHLIGHT_SYNC_BYTES      = 256 << 10;  // and at most this many bytes of them
+const uint32_t HIGHLIGHT_CHUNK_LINES     = 4096;       // line states per handoff from the thread
+const uint32_t HIGHLIGHT_READ_BYTES      = 4 << 10;    // bytes of a row lexed at a time
+const uint32_t HIGHLIGHT_DELIMITER_BYTES = 16;         // longest open or close a grammar may use
+
+/* Design of yano::Grammar and yano::Highlighter:
+    1. A grammar is a text file in <config>/syntax, one directive per line ('#' lines are
+       comments):
+           name     <name>
+           files    <.ext> ...                 extensions the grammar applies to
+           color    <class> <0x00RRGGBB>       a token class; up to ATTR_COLORS - 1 of them
+           keywords <class> <word> ...
+           line     <class> <open> [start]     runs to the end of the line; "start" only
+                                               matches as the first non-blank on a line
+           block    <class> <open> <close>     may span lines
+           quoted   <class> <quote> [escape]   ends at the next unescaped quote or the line
+           numbers  <class>
+       Opens and closes are at most HIGHLIGHT_DELIMITER_BYTES long. Rules are tried in
+       file order at every byte; identifiers are looked up in the
+       keywords, and anything else is the theme's foreground (color 0).
+    2. The lexer's state between lines is a byte: 0, or 1 + the block rule left open.
+       m_states holds the state at the start of every line lexed so far, and lines
+       [0, m_valid) are known to be right. Colors for a line on screen come from lexing
+       just that line from its state.
+    3. An edit keeps the states above it, shifts the ones below by the lines it added or
+       removed, and lexes again from the edited line until a line ends in the state it
+       ended in before: from there on nothing changed, and m_valid jumps back to the
+       end of m_states. Typing inside a line converges on the next line.
+    4. The lines ahead of m_valid are lexed on a thread over a snapshot of the text's runs
+       (see PieceTable::forEachRun), which stays readable while the editor edits. States
+       are handed over in chunks by drain() on the editor thread, which also stops at
+       convergence. The editor thread lexes at most HIGHLIGHT_SYNC_LINES lines, and
+       HIGHLIGHT_SYNC_BYTES bytes, itself per request; rows further out are drawn plain
+       until the thread reaches them, so a large file or a long row never holds up typing.
+    5. Only a row's end state is needed to go on to the next, and a Grammar::Lexer finds
+       it from pieces of the row, lexed where they lie: nothing holds a whole row, and
+       the thread checks for cancel() every HIGHLIGHT_READ_BYTES. Between pieces it keeps
+       what the row is inside of and the few bytes that may start a delimiter.
+*/
+
+namespace yano
+{
+    class Grammar
+    {
+        public:
+            Grammar() {}
+            Grammar(const Grammar &) = delete;    // m_keywords points into m_words
+
+            // false if path cannot be read or has a malformed directive
+            bool load(const std::string &path);
+            // whether path has one of the grammar's extensions
+            bool matches(const std::string &path) const;
+
+            // lex one line (without its '\n') from state, writing a color index per byte to
+            // colors unless it is null; returns the state at the end of the line
+            uint8_t lex(const char *line, size_t length, uint8_t state, uint8_t *colors) const;
+
+            // where lexing a row in pieces has got to
+            typedef struct Lexer {
+                int      rule;          // rule whose text the bytes so far end in, or -1
+                bool     word;          // the bytes so far end in an identifier or number
+                bool     escaped;       // quoted: the byte before was the escape
+                bool     blank;         // nothing but blanks since the row's first block closed
+                uint8_t  held_length;
+                char     held[HIGHLIGHT_DELIMITER_BYTES];   // may start a delimiter
+            } Lexer;
+            // lex a row a piece at a time: begin() from the state at its start, feed() its
+            // bytes (without the '\n') in order, and finish() returns what lex() would
+            void    begin(Lexer &lexer, uint8_t state) const;
+            void    feed(Lexer &lexer, const char *bytes, size_t length) const;
+            uint8_t finish(Lexer &lexer) const;
+
+            const std::string &name() const { return m_name; }
+            // foreground of each color index; entry 0 is filled in by the caller
+            const uint32_t *palette() const { return m_palette; }
+
+        private:
+            enum RuleKind { RULE_LINE, RULE_BLOCK, RULE_QUOTED };
+
+            typedef struct Rule {
+                RuleKind     kind;
+                uint8_t      color;
+                std::string  open;
+                std::string  close;         // block: the closing delimiter
+                char         escape;        // quoted: 0 if none
+                bool         line_start;    // line: only as the first non-blank
+                uint8_t      state;         // block: the state while inside it
+            } Rule;
+
+            std::string                   m_name;
+            std::vector<std::string>      m_extensions;
+            std::vector<Rule>             m_rules;
+            std::vector<uint32_t>         m_blocks;         // state - 1 to its rule
+            std::deque<std::string>       m_words;          // backing for m_keywords' keys
+            std::unordered_map<std::string_view, uint8_t>  m_keywords;
+            std::unordered_map<std::string, uint8_t>       m_classes;
+            uint32_t                      m_palette[ATTR_COLORS] = {};
+            uint8_t                       m_number_color = 0;
+
+            // index of a class named by a color directive, or -1
+            int classIndex(const std::string &name) const;
+            // advance lexer over the tokens that start in bytes [i, to) of length bytes, and
+            // return where it stopped: at to or past it, or short of it where a delimiter
+            // may go on past length. last means length is the end of the row
+            size_t scan(Lexer &lexer, const char *bytes, size_t i, size_t to, size_t length, bool last) const;
+            static bool word(char c) {
+                return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                       c == '_' || (uint8_t)c >= 0x80;
+            }
+    };
+
+    class Highlighter
+    {
+        public:
+            ~Highlighter() { cancel(); }
+
+            // pick the grammar in <configDir>/syntax for path and forget every state;
+            // false when none applies, leaving text plain
+            bool load(const std::string &configDir, const std::string &path);
+            bool active() { return m_grammar != nullptr; }
+            // every row has its state (or there is nothing to color)
+            bool complete() { return m_grammar == nullptr || m_complete; }
+            // the grammar's colors, or nullptr when not active
+            const uint32_t *palette() { return m_grammar ? m_grammar->palette() : nullptr; }
+
+            // editor thread: color index per byte of the visible start of row, or nullptr
+            // while its state is further off than the editor thread may lex
+            const uint8_t *colorLine(PieceTable &text, uint64_t row, const char *bytes, size_t length);
+            // editor thread: rows [first, last] changed and the text gained lines lines
+            // (negative if it lost some). Returns the last row whose colors may have
+            // changed, INT_MAX if not yet known
+            int edited(PieceTable &text, int first, int last, int64_t lines);
+            // editor thread: the text got longer at its end. No state changes, but the
+            // thread's snapshot (if it is going) ends short of the new rows
+            void grew() {
+                m_complete = false;
+                m_grew = true;
+            }
+            // editor thread: lex ahead of m_valid on the thread unless it is already going
+            void resume(PieceTable &text, std::function<void()> progress);
+            // editor thread: take the thread's states; rows [first, last] got theirs.
+            // False if nothing new arrived
+            bool drain(int &first, int &last);
+            // stop the thread; required before the text is reopened
+            void cancel();
+
+        private:
+            typedef struct Chunk {
+                uint64_t              first_row;    // row whose start state is states[0]
+                std::vector<uint8_t>  states;
+            } Chunk;
+
+            typedef struct Run {
+                const char *data;
+                uint64_t    length;
+            } Run;
+
+            std::deque<Grammar>   m_grammars;       // never moved; see Grammar
+            const Grammar        *m_grammar = nullptr;
+            std::vector<uint8_t>  m_states;         // state at the start of each row lexed
+            uint64_t              m_valid = 1;      // rows whose state is right
+            uint64_t              m_converged = 0;  // row where the last convergence happened
+            int64_t               m_converge_after = -1;  // edited rows end here; INT64_MAX: never
+            std::vector<uint8_t>  m_colors;
+
+            std::thread           m_thread;
+            std::atomic<bool>     m_cancel{false};
+            std::mutex            m_lock;
+            std::deque<Chunk>     m_done;           // lexed, waiting for drain()
+            bool                  m_finished = true;   // the thread reached the end of its snapshot
+            bool                  m_complete = false;  // every row is valid
+            bool                  m_grew = false;      // text was appended after the snapshot
+
+            // lex rows on the editor thread until row until is valid, the text ends, or the
+            // state converges; true on convergence
+            bool advance(PieceTable &text, uint64_t until);
+            // record the state at the start of row, checking it against the old one there
+            bool adopt(uint64_t row, uint8_t state);
+            void lexRuns(std::vector<Run> runs, uint64_t row, uint8_t state, std::function<void()> progress);
+    };
+};
+
+bool
+yano::Grammar::load(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in.is_open()) return false;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream words(line);
+        std::string directive, cls;
+        if (!(words >> directive) || directive[0] == '#') continue;
+        if (directive == "name") {
+            std::getline(words >> std::ws, m_name);
+            continue;
+        }
+        if (directive == "files") {
+            for (std::string ext; words >> ext; )
+                m_extensions.push_back(ext);
+            continue;
+        }
+
+        bool ok = (bool)(words >> cls);
+        if (ok && directive == "color") {
+            std::string value;
+            ok = (words >> value) && m_classes.size() + 1 < ATTR_COLORS && !m_classes.count(cls);
+            if (ok) {
+                uint8_t index = m_classes.size() + 1;
+                m_classes[cls] = index;
+                m_palette[index] = strtoul(value.c_str(), NULL, 16);
+            }
+        } else if (ok && classIndex(cls) < 0) {
+            ok = false;     // classes are declared before use
+        } else if (ok && directive == "keywords") {
+            for (std::string word; words >> word; ) {
+                m_words.push_back(word);
+                m_keywords[m_words.back()] = classIndex(cls);
+            }
+        } else if (ok && directive == "numbers") {
+            m_number_color = classIndex(cls);
+        } else if (ok && (directive == "line" || directive == "block" || directive == "quoted")) {
+            Rule rule = { RULE_LINE, (uint8_t)classIndex(cls), "", "", 0, false, 0 };
+            std::string extra;
+            ok = (words >> rule.open) && rule.open.size() <= HIGHLIGHT_DELIMITER_BYTES;
+            if (directive == "line") {
+                rule.line_start = (words >> extra) && extra == "start";
+            } else if (directive == "block") {
+                rule.kind = RULE_BLOCK;
+                ok = ok && (words >> rule.close) && rule.close.size() <= HIGHLIGHT_DELIMITER_BYTES &&
+                     m_blocks.size() < 255;
+                if (ok) {
+                    m_blocks.push_back(m_rules.size());
+                    rule.state = m_blocks.size();
+                }
+            } else {
+                rule.kind = RULE_QUOTED;
+                ok = ok && rule.open.size() == 1;
+                if (words >> extra) rule.escape = extra[0];
+            }
+            if (ok) m_rules.push_back(rule);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            printf("Error: bad grammar directive in %s: %s\n", path.c_str(), line.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+yano::Grammar::matches(const std::string &path) const
+{
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos) return false;
+    for (const std::string &ext : m_extensions)
+        if (path.compare(dot, std::string::npos, ext) == 0) return true;
+    return false;
+}
+
+int
+yano::Grammar::classIndex(const std::string &name) const
+{
+    auto it = m_classes.find(name);
+    return (it == m_classes.end()) ? -1 : it->second;
+}
+
+uint8_t
+yano::Grammar::lex(const char *line, size_t length, uint8_t state, uint8_t *colors) const
+{
+    auto paint = [colors](size_t from, size_t to, uint8_t color) {
+        if (colors) memset(colors + from, color, to - from);
+    };
+    auto at = [line, length](size_t i, const std::string &s) {
+        return i + s.size() <= length && memcmp(line + i, s.data(), s.size()) == 0;
+    };
+
+    size_t i = 0;
+    // finish a block left open by an earlier line
+    if (state != 0) {
+        const Rule &rule = m_rules[m_blocks[state - 1]];
+        const char *close = (const char *)memmem(line, length, rule.close.data(), rule.close.size());
+        if (close == NULL) {
+            paint(0, length, rule.color);
+            return state;
+        }
+        i = close - line + rule.close.size();
+        paint(0, i, rule.color);
+        state = 0;
+    }
+
+    size_t first = i;
+    while (first < length && (line[first] == ' ' || line[first] == '\t')) ++first;
+
+    while (i < length) {
+        const Rule *match = nullptr;
+        for (const Rule &rule : m_rules) {
+            if (line[i] == rule.open[0] && at(i, rule.open) && (!rule.line_start || i == first)) {
+                match = &rule;
+                break;
+            }
+        }
+
+        if (match && match->kind == RULE_LINE) {
+            paint(i, length, match->color);
+            return 0;
+        } else if (match && match->kind == RULE_BLOCK) {
+            size_t from = i + match->open.size();
+            const char *close = (const char *)memmem(line + from, length - from,
+                                                     match->close.data(), match->close.size());
+            if (close == NULL) {
+                paint(i, length, match->color);
+                return match->state;
+            }
+            size_t end = close - line + match->close.size();
+            paint(i, end, match->color);
+            i = end;
+        } else if (match) {
+            size_t end = i + 1;
+            while (end < length && line[end] != match->open[0]) {
+                if (match->escape && line[end] == match->escape) ++end;
+                ++end;
+            }
+            end = std::min(end + 1, length);
+            paint(i, end, match->color);
+            i = end;
+        } else if (word(line[i])) {
+            size_t end = i + 1;
+            while (end < length && word(line[end])) ++end;
+            uint8_t color = 0;
+            if (line[i] >= '0' && line[i] <= '9') {
+                color = m_number_color;
+            } else {
+                auto it = m_keywords.find(std::string_view(line + i, end - i));
+                if (it != m_keywords.end()) color = it->second;
+            }
+            paint(i, end, color);
+            i = end;
+        } else {
+            paint(i, i + 1, 0);
+            ++i;
+        }
+    }
+    return 0;
+}
+
+void
+yano::Grammar::begin(Lexer &lexer, uint8_t state) const
+{
+    lexer.rule = (state == 0) ? -1 : (int)m_blocks[state - 1];
+    lexer.word = false;
+    lexer.escaped = false;
+    lexer.blank = true;
+    lexer.held_length = 0;
+}
+
+void
+yano::Grammar::feed(Lexer &lexer, const char *bytes, size_t length) const
+{
+    size_t i = 0;
+    if (lexer.held_length != 0) {
+        // the held bytes and enough of this piece to finish any delimiter they start
+        char joined[2 * HIGHLIGHT_DELIMITER_BYTES];
+        size_t held = lexer.held_length;
+        size_t take = std::min<size_t>(length, HIGHLIGHT_DELIMITER_BYTES);
+        memcpy(joined, lexer.held, held);
+        memcpy(joined + held, bytes, take);
+        size_t stop = scan(lexer, joined, 0, held, held + take, false);
+        if (stop < held) {
+            // only a piece shorter than a delimiter leaves one unfinished
+            lexer.held_length = held + take - stop;
+            memmove(lexer.held, joined + stop, lexer.held_length);
+            return;
+        }
+        i = stop - held;
+    }
+    size_t stop = scan(lexer, bytes, i, length, length, false);
+    lexer.held_length = length - stop;
+    memcpy(lexer.held, bytes + stop, lexer.held_length);
+}
+
+uint8_t
+yano::Grammar::finish(Lexer &lexer) const
+{
+    if (lexer.held_length != 0)
+        scan(lexer, lexer.held, 0, lexer.held_length, lexer.held_length, true);
+    lexer.held_length = 0;
+    // only a block goes on to the next row
+    if (lexer.rule >= 0 && m_rules[lexer.rule].kind == RULE_BLOCK) return m_rules[lexer.rule].state;
+    return 0;
+}
+
+size_t
+yano::Grammar::scan(Lexer &lexer, const char *bytes, size_t i, size_t to, size_t length, bool last) const
+{
+    // the same tokens as lex(), found without painting them
+    while (i < to) {
+        if (lexer.rule >= 0) {
+            const Rule &rule = m_rules[lexer.rule];
+            if (rule.kind == RULE_LINE) return length;
+            if (rule.kind == RULE_BLOCK) {
+                const char *close = (const char *)memmem(bytes + i, length - i, rule.close.data(), rule.close.size());
+                if (close == NULL) {
+                    // a close cut off at the end is looked for again with the next piece
+                    if (last) return length;
+                    return std::max(i, length - std::min(length, rule.close.size() - 1));
+                }
+                i = close - bytes + rule.close.size();
+                lexer.rule = -1;
+                continue;
+            }
+            while (i < length) {
+                char c = bytes[i++];
+                if (lexer.escaped) {
+                    lexer.escaped = false;
+                } else if (c == rule.open[0]) {
+                    lexer.rule = -1;
+                    break;
+                } else if (rule.escape && c == rule.escape) {
+                    lexer.escaped = true;
+                }
+            }
+            continue;
+        }
+        if (lexer.word) {
+            while (i < length && word(bytes[i])) ++i;
+            if (i < length) lexer.word = false;
+            continue;
+        }
+
+        char c = bytes[i];
+        const Rule *match = nullptr;
+        for (const Rule &rule : m_rules) {
+            if (c != rule.open[0] || (rule.line_start && !lexer.blank)) continue;
+            size_t have = std::min(length - i, rule.open.size());
+            if (memcmp(bytes + i, rule.open.data(), have) != 0) continue;
+            if (have < rule.open.size()) {
+                if (last) continue;
+                return i;   // an earlier rule may yet match; wait for the rest
+            }
+            match = &rule;
+            break;
+        }
+        if (c != ' ' && c != '\t') lexer.blank = false;
+        if (match) {
+            lexer.rule = match - m_rules.data();
+            i += match->open.size();
+        } else {
+            lexer.word = word(c);
+            ++i;
+        }
+    }
+    return i;
+}
+
+bool
+yano::Highlighter::load(const std::string &configDir, const std::string &path)
+{
+    cancel();
+    m_grammar = nullptr;
+    m_states.assign(1, 0);
+    m_valid = 1;
+    m_converge_after = -1;
+    m_complete = false;
+
+    // grammars are read once and kept for the next file
+    if (m_grammars.empty()) {
+        std::string dir = configDir + "/syntax";
+        DIR *d = opendir(dir.c_str());
+        if (d == NULL) return false;
+        for (struct dirent *entry; (entry = readdir(d)) != NULL; ) {
+            std::string name = entry->d_name;
+            if (name.size() < 4 || name.compare(name.size() - 4, 4, ".syn") != 0) continue;
+            m_grammars.emplace_back();
+            if (!m_grammars.back().load(dir + "/" + name)) m_grammars.pop_back();
+        }
+        closedir(d);
+    }
+    for (const Grammar &grammar : m_grammars)
+        if (grammar.matches(path)) m_grammar = &grammar;
+    return m_grammar != nullptr;
+}
+
+const uint8_t *
+yano::Highlighter::colorLine(PieceTable &text, uint64_t row, const char *bytes, size_t length)
+{
+    if (m_grammar == nullptr) return nullptr;
+    if (row >= m_valid && row - m_valid < HIGHLIGHT_SYNC_LINES)
+        advance(text, row + 1);
+    if (row >= m_valid) return nullptr;
+
+    const char *newline = (const char *)memchr(bytes, '\n', length);
+    if (newline) length = newline - bytes;
+    m_colors.resize(length);
+    m_grammar->lex(bytes, length, m_states[row], m_colors.data());
+    return m_colors.data();
+}
+
+int
+yano::Highlighter::edited(PieceTable &text, int first, int last, int64_t lines)
+{
+    if (m_grammar == nullptr) return first;
+    cancel();
+    m_complete = false;
+
+    // rows past the edit keep their old states, moved to where their lines went
+    uint64_t below = (uint64_t)first + 1;
+    if (below < m_states.size()) {
+        if (lines > 0)
+            m_states.insert(m_states.begin() + below, lines, 0);
+        else if (lines < 0)
+            m_states.erase(m_states.begin() + below,
+                           m_states.begin() + std::min<uint64_t>(below - lines, m_states.size()));
+    }
+    if (m_converge_after > first && m_converge_after != INT64_MAX)
+        m_converge_after += lines;
+    m_converge_after = std::max<int64_t>(m_converge_after, (last == INT_MAX) ? INT64_MAX : last);
+
+    bool known = below <= m_valid;
+    m_valid = std::min(m_valid, below);
+    if (!known) return first;   // the thread will get there
+
+    // the row that converged starts as before, so only the rows above it can look different
+    if (advance(text, m_valid + HIGHLIGHT_SYNC_LINES)) return m_converged - 1;
+    return (m_valid >= text.lineCount()) ? (int)std::min<uint64_t>(m_valid, INT_MAX) : INT_MAX;
+}
+
+bool
+yano::Highlighter::advance(PieceTable &text, uint64_t until)
+{
+    uint64_t rows = text.lineCount();
+    uint64_t budget = HIGHLIGHT_SYNC_BYTES;
+    while (m_valid < until && m_valid < rows) {
+        // the state at the start of row m_valid is where row m_valid - 1 leaves off
+        uint64_t row = m_valid - 1;
+        uint64_t length = text.lineLength(row);
+        if (length > budget) return false;     // the thread gets to it without holding up typing
+        budget -= length;
+        Grammar::Lexer lexer;
+        m_grammar->begin(lexer, m_states[row]);
+        text.forEachSpan(text.lineStart(row), length, [&](const char *data, uint64_t n) {
+            m_grammar->feed(lexer, data, n);
+            return true;
+        });
+        if (adopt(m_valid, m_grammar->finish(lexer))) return true;
+    }
+    return false;
+}
+
+bool
+yano::Highlighter::adopt(uint64_t row, uint8_t state)
+{
+    if (row < m_states.size()) {
+        // an old state that comes out the same again means nothing below changed
+        if ((int64_t)row > m_converge_after && m_states[row] == state) {
+            m_converged = row;
+            m_valid = m_states.size();
+            m_converge_after = -1;
+            return true;
+        }
+        m_states[row] = state;
+    } else {
+        m_states.push_back(state);
+    }
+    m_valid = row + 1;
+    if (m_valid >= m_states.size()) m_converge_after = -1;
+    return false;
+}
+
+void
+yano::Highlighter::resume(PieceTable &text, std::function<void()> progress)
+{
+    if (m_grammar == nullptr || m_complete || m_thread.joinable()) return;
+    // a row the index has not reached would be scanned for right here; wait for the indexer
+    if (m_valid >= text.lineCount()) {
+        if (text.fullyIndexed()) m_complete = true;
+        return;
+    }
+
+    uint64_t row = m_valid - 1;
+    uint64_t skip = text.lineStart(row);
+    std::vector<Run> runs;
+    text.forEachRun([&runs, &skip](const char *data, uint64_t length) {
+        if (skip >= length) {
+            skip -= length;
+        } else {
+            runs.push_back({ data + skip, length - skip });
+            skip = 0;
+        }
+        return true;
+    });
+
+    m_cancel = false;
+    m_finished = false;
+    m_grew = false;
+    m_thread = std::thread(&Highlighter::lexRuns, this, std::move(runs), row, m_states[row], progress);
+}
+
+bool
+yano::Highlighter::drain(int &first, int &last)
+{
+    if (!m_thread.joinable()) return false;
+    std::deque<Chunk> chunks;
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        chunks.swap(m_done);
+        finished = m_finished;
+    }
+    if (chunks.empty() && !finished) return false;
+
+    uint64_t from = m_valid;
+    bool converged = false;
+    for (const Chunk &chunk : chunks) {
+        for (size_t i = 0; i < chunk.states.size() && !converged; ++i) {
+            uint64_t row = chunk.first_row + i;
+            if (row < m_valid) continue;
+            converged = adopt(row, chunk.states[i]);
+        }
+    }
+    // past convergence the thread only repeats what is known; resume() starts it again
+    // from the end of m_states
+    if (converged || finished) {
+        cancel();
+        if (finished && !converged && !m_grew) m_complete = true;
+    }
+    first = (int)std::min<uint64_t>(from, INT_MAX);
+    last = (int)std::min<uint64_t>(converged ? m_converged : m_valid, INT_MAX);
+    return m_valid > from || converged;
+}
+
+void
+yano::Highlighter::cancel()
+{
+    m_cancel = true;
+    if (m_thread.joinable()) m_thread.join();
+    m_done.clear();
+    m_finished = true;
+}
+
+void
+yano::Highlighter::lexRuns(std::vector<Run> runs, uint64_t row, uint8_t state, std::function<void()> progress)
+{
+    Grammar::Lexer lexer;
+    m_grammar->begin(lexer, state);
+    Chunk chunk = { row + 1, {} };
+    auto finishLine = [&]() {
+        state = m_grammar->finish(lexer);
+        m_grammar->begin(lexer, state);
+        chunk.states.push_back(state);
+        if (chunk.states.size() < HIGHLIGHT_CHUNK_LINES) return;
+        uint64_t next = chunk.first_row + chunk.states.size();
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_done.push_back(std::move(chunk));
+        }
+        chunk = { next, {} };
+        if (progress) progress();
+    };
+
+    // a piece at a time, so a long row neither is copied nor holds up cancel()
+    for (const Run &run : runs) {
+        const char *p = run.data;
+        const char *end = run.data + run.length;
+        while (p < end) {
+            if (m_cancel.load(std::memory_order_relaxed)) return;
+            const char *piece = p + std::min<uint64_t>(end - p, HIGHLIGHT_READ_BYTES);
+            const char *newline = (const char *)memchr(p, '\n', piece - p);
+            if (newline == NULL) {
+                m_grammar->feed(lexer, p, piece - p);
+                p = piece;
+                continue;
+            }
+            m_grammar->feed(lexer, p, newline - p);
+            finishLine();
+            p = newline + 1;
+        }
+    }
+
+    // the last row has no row after it to give a state to
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!chunk.states.empty()) m_done.push_back(std::move(chunk));
+        m_finished = true;
+    }
+    if (progress) progress();
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef INDEXER_H
+#define INDEXER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "piecetable.h"
+
+/* Design of yano::LineIndexer:
+    1. A freshly opened file has no newline index; the PieceTable scans it a chunk at
+       a time on the editor thread as queries reach further in. The indexer does the
+       same scan ahead of time on its own thread, so going far into a multi-GB file
+       does not stall the editor.
+    2. The thread only reads the mapped text, which never changes, and keeps its results
+       to itself until the editor calls drain(). drain() hands finished chunks to the
+       PieceTable in order with adoptChunk(); chunks the editor already scanned on
+       demand meanwhile are dropped.
+    3. progress is called from the thread after each chunk. yano::Yano wires it to an
+       event loop wakeup, so drain() runs on the editor thread.
+*/
+
+namespace yano
+{
+    class LineIndexer
+    {
+        public:
+            ~LineIndexer() { cancel(); }
+
+            // scan what text has not indexed yet, replacing any scan in progress
+            void start(PieceTable &text, std::function<void()> progress);
+            // editor thread: give text every chunk scanned so far; true once nothing is left
+            bool drain(PieceTable &text);
+            // stop the thread; required before the text is reopened
+            void cancel();
+
+        private:
+            typedef struct Chunk {
+                uint32_t               buffer;
+                uint64_t               start;
+                uint64_t               length;
+                std::vector<uint64_t>  newlines;    // offsets in the buffer
+            } Chunk;
+
+            typedef struct Run {
+                uint32_t    buffer;
+                uint64_t    start;
+                const char *data;
+                uint64_t    length;
+            } Run;
+
+            std::thread          m_thread;
+            std::atomic<bool>    m_cancel{false};
+            std::mutex           m_lock;
+            std::deque<Chunk>    m_done;         // scanned, waiting for drain()
+            std::vector<Chunk>   m_draining;     // drain()'s private copy
+            bool                 m_finished = true;
+
+            void scan(std::vector<Run> runs, std::function<void()> progress);
+    };
+};
+
+void
+yano::LineIndexer::start(PieceTable &text, std::function<void()> progress)
+{
+    cancel();
+
+    std::vector<Run> runs;
+    text.forEachUnindexed([&runs](uint32_t buffer, uint64_t start, const char *data, uint64_t length) {
+        runs.push_back({ buffer, start, data, length });
+    });
+    if (runs.empty()) return;
+
+    m_cancel = false;
+    m_finished = false;
+    m_thread = std::thread(&LineIndexer::scan, this, std::move(runs), progress);
+}
+
+bool
+yano::LineIndexer::drain(PieceTable &text)
+{
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_draining.assign(std::make_move_iterator(m_done.begin()), std::make_move_iterator(m_done.end()));
+        m_done.clear();
+        finished = m_finished;
+    }
+    for (const Chunk &chunk : m_draining)
+        text.adoptChunk(chunk.buffer, chunk.start, chunk.length, chunk.newlines);
+    m_draining.clear();
+    return finished;
+}
+
+void
+yano::LineIndexer::cancel()
+{
+    m_cancel = true;
+    if (m_thread.joinable()) m_thread.join();
+    m_done.clear();
+    m_finished = true;
+}
+
+void
+yano::LineIndexer::scan(std::vector<Run> runs, std::function<void()> progress)
+{
+    for (const Run &run : runs) {
+        // cut chunks exactly where PieceTable::indexChunk() would
+        for (uint64_t at = 0; at < run.length; at += INDEX_CHUNK_SIZE) {
+            if (m_cancel.load(std::memory_order_relaxed)) return;
+
+            Chunk chunk;
+            chunk.buffer = run.buffer;
+            chunk.start = run.start + at;
+            chunk.length = std::min(run.length - at, INDEX_CHUNK_SIZE);
+            const char *base = run.data - run.start;
+            const char *p = run.data + at;
+            const char *end = p + chunk.length;
+            while ((p = (const char *)memchr(p, '\n', end - p)) != NULL) {
+                chunk.newlines.push_back(p - base);
+                ++p;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_done.push_back(std::move(chunk));
+            }
+            if (progress) progress();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_finished = true;
+    }
+    if (progress) progress();
+}
+
+#endif
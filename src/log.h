@@ -0,0 +1,15 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <cstdio>
+
+// diagnostics that only debug builds print (make debug defines YANO_DEBUG); in
+// other builds the call and its arguments compile away entirely. Errors the user
+// needs to see still go through printf.
+#ifdef YANO_DEBUG
+#define YANO_LOG(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define YANO_LOG(...) ((void)0)
+#endif
+
+#endif
@@ -1,7 +1,22 @@
+#include <cstdio>
+#include <cstring>
+
 #include "yano.h"
 
-int main() {
+int main(int argc, char **argv) {
+    // yano [-f] [file]; -f follows the file as it grows
+    bool follow = argc > 1 && strcmp(argv[1], "-f") == 0;
+    const char *path = (argc > 1 + follow) ? argv[1 + follow] : NULL;
+    if (follow && path == NULL) {
+        printf("Error: -f needs a file to follow.\nUsage: yano [-f] [file]\n");
+        return 1;
+    }
+
     yano::Yano yano = yano::Yano(2560, 1600, "boxxy", 3);
+    if (path && !yano.openFile(path))
+        return 1;
+    if (follow && !yano.follow(true))
+        return 1;
     yano.run();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,183 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "alloc.h"
+
+const int    HISTOGRAM_SUB_BITS = 3;    // 2^3 buckets per power of two: within 12.5%
+const int    HISTOGRAM_BUCKETS  = (64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS;
+const size_t METRICS_LINE_WIDTH = 36;   // characters in a summary() line
+const char  *METRICS_DUMP_PATH  = "yano-metrics.txt";   // unless $YANO_METRICS says otherwise
+
+/* Design of yano::Metrics:
+    1. Each stage of getting a keystroke onto the screen has a Histogram of how long
+       it took, in nanoseconds of the steady clock. Buckets are log-linear, so a
+       histogram is a fixed 4KB whatever it holds and recording is a couple of
+       relaxed atomic adds: cheap enough to leave on in every build.
+    2. The editor thread records the stages up to publishing a frame, the render
+       thread the ones after. A Frame carries the time of the oldest key it answers,
+       so the render thread can close the keystroke-to-present interval once the
+       frame has been flushed. A frame replaced in the mailbox before it was drawn
+       passes its time on to the frame that replaces it, so coalesced frames lose no
+       samples; in the rare race where it is drawn after all, a key counts twice.
+    3. Percentiles are read straight from the buckets, so they are exact to within
+       one bucket and reading them never stops the threads that record.
+*/
+
+namespace yano
+{
+    enum Stage {
+        STAGE_INPUT,        // keys received until the edits they cause are applied
+        STAGE_LAYOUT,       // edits applied until the frame showing them is published
+        STAGE_QUEUE,        // frame published until the render thread takes it
+        STAGE_RASTER,       // changed cells drawn into drawable
+        STAGE_UPLOAD,       // damaged areas put to the pixmap and copied to the window
+        STAGE_FLUSH,        // requests written to the X connection
+        STAGE_FRAME,        // render thread's work per frame: raster through flush
+        STAGE_LATENCY,      // key received until the frame showing it is flushed
+        STAGE_COUNT
+    };
+
+    const char *const STAGE_NAMES[STAGE_COUNT] = {
+        "input", "layout", "queue", "raster", "upload", "flush", "frame", "latency"
+    };
+
+    class Histogram
+    {
+        public:
+            Histogram();
+
+            void     record(uint64_t value);
+            uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+            uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+            uint64_t mean() const { return count() ? m_sum.load(std::memory_order_relaxed) / count() : 0; }
+            // value that a fraction p of the samples do not exceed
+            uint64_t percentile(double p) const;
+
+        private:
+            std::atomic<uint64_t>  m_buckets[HISTOGRAM_BUCKETS];
+            std::atomic<uint64_t>  m_count{0};
+            std::atomic<uint64_t>  m_sum{0};
+            std::atomic<uint64_t>  m_max{0};
+
+            static int      bucket(uint64_t value);
+            static uint64_t bucketLow(int index);
+    };
+
+    class Metrics
+    {
+        public:
+            // nanoseconds on the steady clock; 0 is never returned, so it can mean "unset"
+            static uint64_t now() {
+                auto t = std::chrono::steady_clock::now().time_since_epoch();
+                return std::max<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t).count(), 1);
+            }
+
+            void record(Stage stage, uint64_t ns) { m_stages[stage].record(ns); }
+            const Histogram &stage(Stage stage) const { return m_stages[stage]; }
+
+            // "name  p50  p99  max" in milliseconds, at most METRICS_LINE_WIDTH characters
+            void summary(Stage stage, char *out, size_t size) const;
+            static const char *summaryHeader() { return "stage ms      p50      p99      max"; }
+
+            // every stage in microseconds, then the allocation counters, one record per line
+            bool dump(const char *path) const;
+
+        private:
+            Histogram  m_stages[STAGE_COUNT];
+    };
+};
+
+yano::Histogram::Histogram()
+{
+    for (std::atomic<uint64_t> &b : m_buckets)
+        b.store(0, std::memory_order_relaxed);
+}
+
+void
+yano::Histogram::record(uint64_t value)
+{
+    // a single writer per histogram, but the overlay and dump read from other threads
+    m_buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t seen = m_max.load(std::memory_order_relaxed);
+    while (value > seen && !m_max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+uint64_t
+yano::Histogram::percentile(double p) const
+{
+    uint64_t total = count();
+    if (total == 0) return 0;
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p * total + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen < rank) continue;
+        // the middle of the bucket, but never past the largest sample
+        uint64_t low = bucketLow(i);
+        uint64_t high = (i + 1 < HISTOGRAM_BUCKETS) ? bucketLow(i + 1) - 1 : UINT64_MAX;
+        return std::min(low + (high - low) / 2, max());
+    }
+    return max();
+}
+
+int
+yano::Histogram::bucket(uint64_t value)
+{
+    // small values get a bucket each; past that, each power of two is split in 2^SUB_BITS
+    const uint64_t sub = 1 << HISTOGRAM_SUB_BITS;
+    if (value < sub) return value;
+    int e = 63 - __builtin_clzll(value);
+    return ((e - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) +
+           ((value >> (e - HISTOGRAM_SUB_BITS)) & (sub - 1));
+}
+
+uint64_t
+yano::Histogram::bucketLow(int index)
+{
+    const uint64_t sub = 1 << HISTOGRAM_SUB_BITS;
+    if ((uint64_t)index < sub) return index;
+    int e = (index >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+    return (sub + (index & (sub - 1))) << (e - HISTOGRAM_SUB_BITS);
+}
+
+void
+yano::Metrics::summary(Stage stage, char *out, size_t size) const
+{
+    const Histogram &h = m_stages[stage];
+    snprintf(out, std::min(size, METRICS_LINE_WIDTH + 1), "%-8s %8.2f %8.2f %8.2f",
+             STAGE_NAMES[stage], h.percentile(0.5) / 1e6, h.percentile(0.99) / 1e6, h.max() / 1e6);
+}
+
+bool
+yano::Metrics::dump(const char *path) const
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    fprintf(file, "# stage count p50_us p99_us max_us mean_us\n");
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        const Histogram &h = m_stages[s];
+        fprintf(file, "%s %llu %.1f %.1f %.1f %.1f\n", STAGE_NAMES[s], (unsigned long long)h.count(),
+                h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3, h.max() / 1e3, h.mean() / 1e3);
+    }
+
+    AllocCounters &a = allocCounters();
+    fprintf(file, "# alloc counter value\n");
+    fprintf(file, "alloc pool_allocs %llu\n", (unsigned long long)a.pool_allocs.load());
+    fprintf(file, "alloc pool_frees %llu\n", (unsigned long long)a.pool_frees.load());
+    fprintf(file, "alloc arena_allocs %llu\n", (unsigned long long)a.arena_allocs.load());
+    fprintf(file, "alloc arena_resets %llu\n", (unsigned long long)a.arena_resets.load());
+    fprintf(file, "alloc heap_blocks %llu\n", (unsigned long long)a.heap_blocks.load());
+    fprintf(file, "alloc heap_bytes %llu\n", (unsigned long long)a.heap_bytes.load());
+    return fclose(file) == 0;
+}
+
+#endif
@@ -0,0 +1,663 @@
+#ifndef NFA_H
+#define NFA_H
+
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+const uint32_t NFA_MAX_PROGRAM = 1 << 16;  // instructions a pattern may compile to
+
+/* Design of yano::Regex:
+    1. std::regex backtracks recursively, a stack frame or more per byte, so a long line
+       overflows the thread's stack. Regex compiles the pattern to a program for a Pike
+       VM (Thompson's construction run breadth-first): every possible thread advances
+       one byte at a time, so matching takes O(bytes * program) time and no stack,
+       however long the line.
+    2. The syntax is the ECMAScript subset that needs no backtracking: literals, '.',
+       classes with ranges and \d \w \s (and their negations), groups and (?:),
+       alternation, the greedy and lazy quantifiers * + ? {n} {n,} {n,m}, and the
+       assertions ^ $ \b \B. Backreferences and lookaround do not compile.
+    3. Threads are kept in priority order and a match cuts off the ones behind it, so
+       the match found is the one a backtracking engine would find: leftmost, then
+       preferring earlier alternatives and greedier repeats.
+    4. While no thread is alive, the VM skips to the next byte that can start a match
+       (with memchr when only one can), so a rare pattern costs little more than a
+       scan for its first byte.
+    5. Text may come in pieces, such as the runs of a PieceTable that a line spans. The
+       VM reads it by position through a Reader, which follows the pieces, so nothing
+       is joined and ^ $ \b see across the seams as if the text were one.
+*/
+
+namespace yano
+{
+    class Regex
+    {
+        public:
+            // per-thread state for matching; one Regex may be used by several threads at
+            // once, each with its own Scratch
+            typedef struct Scratch {
+                typedef struct Thread {
+                    uint32_t  pc;
+                    size_t    start;
+                } Thread;
+                std::vector<Thread>    current;
+                std::vector<Thread>    next;
+                std::vector<uint32_t>  mark;        // generation that last added each pc
+                std::vector<uint32_t>  stack;
+                uint32_t               generation = 0;
+            } Scratch;
+
+            // false if pattern is malformed or uses what the VM cannot run
+            bool compile(const std::string &pattern);
+
+            // a stretch of text, matched as if joined to the pieces before and after it
+            typedef struct Piece {
+                const char *data;
+                size_t      length;
+            } Piece;
+
+            // call fn(size_t start, size_t length) for every non-empty match in text, in
+            // order and without overlaps, as std::regex_iterator would find them
+            template <typename F>
+            void forEachMatch(const char *text, size_t length, Scratch &scratch, F fn) const;
+            // the same over the text the count pieces make in order; none may be empty
+            template <typename F>
+            void forEachMatch(const Piece *pieces, size_t count, Scratch &scratch, F fn) const;
+
+        private:
+            enum Op { OP_CHAR, OP_ANY, OP_CLASS, OP_SPLIT, OP_JUMP, OP_MATCH,
+                      OP_LINE_START, OP_LINE_END, OP_WORD, OP_NOT_WORD };
+
+            typedef struct Instruction {
+                Op        op;
+                uint32_t  x;            // byte, class, or first target
+                uint32_t  y;            // second target of OP_SPLIT, taken after x
+            } Instruction;
+
+            // reads the text of some pieces by position; mostly forward, so it keeps the
+            // piece it read last
+            typedef struct Reader {
+                const Piece  *pieces;
+                size_t        count;
+                size_t        length;       // of all the pieces
+                size_t        k = 0;        // the piece read last
+                size_t        base = 0;     // where it starts in the text
+                // move to the piece holding i < length
+                void seek(size_t i) {
+                    while (i < base) base -= pieces[--k].length;
+                    while (i >= base + pieces[k].length) base += pieces[k++].length;
+                }
+                uint8_t at(size_t i) {
+                    if (i - base >= pieces[k].length) seek(i);     // also when i < base
+                    return pieces[k].data[i - base];
+                }
+            } Reader;
+
+            typedef struct Node {
+                enum Kind { ATOM, CONCAT, ALTERNATE, REPEAT } kind;
+                Op                                  op = OP_CHAR;  // of an ATOM
+                uint32_t                            x = 0;
+                std::vector<std::unique_ptr<Node>>  children;
+                int                                 min = 0;       // of a REPEAT; max -1 is unbounded
+                int                                 max = 0;
+                bool                                greedy = true;
+            } Node;
+
+            std::vector<Instruction>     m_program;
+            std::vector<std::bitset<256>> m_classes;
+            std::bitset<256>             m_first;           // bytes a match can start with
+            bool                         m_skip = false;    // false if a match may be empty
+            int                          m_single = -1;     // the one first byte, or -1
+
+            // recursive descent over the pattern; nullptr on a syntax error
+            std::unique_ptr<Node> parseAlternate(const std::string &p, size_t &i, int depth);
+            std::unique_ptr<Node> parseConcat(const std::string &p, size_t &i, int depth);
+            std::unique_ptr<Node> parseAtom(const std::string &p, size_t &i, int depth);
+            bool parseClass(const std::string &p, size_t &i, std::bitset<256> &set);
+            // the set \d, \w, \s (or its negation) for letter, or false if it names none
+            static bool escapeClass(char letter, std::bitset<256> &set);
+            // the byte an escape stands for in a literal, or -1 if it is not one
+            static int  escapeByte(const std::string &p, size_t &i);
+            static bool isWord(char c) {
+                return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+            }
+
+            bool emit(const Node &node);
+            uint32_t add(Op op, uint32_t x = 0, uint32_t y = 0) {
+                m_program.push_back({ op, x, y });
+                return m_program.size() - 1;
+            }
+            // find the bytes that can start a match, for skipping ahead
+            void firstBytes();
+
+            // add the thread at pc, and every thread it reaches without consuming a byte,
+            // to list in priority order; at is where in text the thread stands
+            void follow(Scratch &scratch, std::vector<Scratch::Thread> &list, uint32_t pc, size_t start,
+                        Reader &text, size_t at) const;
+            // the first byte at or after at that can start a match, or text.length
+            size_t skip(Reader &text, size_t at) const;
+            // the leftmost-first match at or after from (exactly at from if anchored), non-empty
+            // if not_empty; false if there is none
+            bool find(Reader &text, size_t from, bool anchored, bool not_empty,
+                      Scratch &scratch, size_t &start, size_t &end) const;
+    };
+};
+
+bool
+yano::Regex::compile(const std::string &pattern)
+{
+    m_program.clear();
+    m_classes.clear();
+    size_t i = 0;
+    std::unique_ptr<Node> root = parseAlternate(pattern, i, 0);
+    if (!root || i != pattern.size()) return false;
+    if (!emit(*root)) return false;
+    add(OP_MATCH);
+    firstBytes();
+    return true;
+}
+
+std::unique_ptr<yano::Regex::Node>
+yano::Regex::parseAlternate(const std::string &p, size_t &i, int depth)
+{
+    // nesting is bounded so that parsing cannot overflow the stack either
+    if (depth > 256) return nullptr;
+    std::unique_ptr<Node> first = parseConcat(p, i, depth);
+    if (!first || i >= p.size() || p[i] != '|') return first;
+
+    std::unique_ptr<Node> node(new Node);
+    node->kind = Node::ALTERNATE;
+    node->children.push_back(std::move(first));
+    while (i < p.size() && p[i] == '|') {
+        ++i;
+        std::unique_ptr<Node> next = parseConcat(p, i, depth);
+        if (!next) return nullptr;
+        node->children.push_back(std::move(next));
+    }
+    return node;
+}
+
+std::unique_ptr<yano::Regex::Node>
+yano::Regex::parseConcat(const std::string &p, size_t &i, int depth)
+{
+    std::unique_ptr<Node> node(new Node);
+    node->kind = Node::CONCAT;
+    while (i < p.size() && p[i] != '|' && p[i] != ')') {
+        std::unique_ptr<Node> atom = parseAtom(p, i, depth);
+        if (!atom) return nullptr;
+
+        // quantifiers, each applying to everything before it
+        while (i < p.size()) {
+            int min, max;
+            size_t j = i;
+            if (p[j] == '*') {
+                min = 0;
+                max = -1;
+                ++j;
+            } else if (p[j] == '+') {
+                min = 1;
+                max = -1;
+                ++j;
+            } else if (p[j] == '?') {
+                min = 0;
+                max = 1;
+                ++j;
+            } else if (p[j] == '{') {
+                // {n}, {n,} or {n,m}; anything else is a literal '{'
+                size_t k = j + 1;
+                auto number = [&p, &k](int &n) {
+                    size_t from = k;
+                    n = 0;
+                    while (k < p.size() && p[k] >= '0' && p[k] <= '9' && n <= 100000)
+                        n = n * 10 + (p[k++] - '0');
+                    return k > from;
+                };
+                if (!number(min)) break;
+                max = min;
+                if (k < p.size() && p[k] == ',') {
+                    ++k;
+                    if (!number(max)) max = -1;
+                }
+                if (k >= p.size() || p[k] != '}') break;
+                if (max != -1 && max < min) return nullptr;
+                j = k + 1;
+            } else {
+                break;
+            }
+            if (atom->kind == Node::ATOM && atom->op >= OP_LINE_START) return nullptr;  // nothing to repeat
+
+            std::unique_ptr<Node> repeat(new Node);
+            repeat->kind = Node::REPEAT;
+            repeat->min = min;
+            repeat->max = max;
+            if (j < p.size() && p[j] == '?') {
+                repeat->greedy = false;
+                ++j;
+            }
+            repeat->children.push_back(std::move(atom));
+            atom = std::move(repeat);
+            i = j;
+        }
+        node->children.push_back(std::move(atom));
+    }
+    return node;
+}
+
+std::unique_ptr<yano::Regex::Node>
+yano::Regex::parseAtom(const std::string &p, size_t &i, int depth)
+{
+    std::unique_ptr<Node> node(new Node);
+    node->kind = Node::ATOM;
+    char c = p[i++];
+    switch (c) {
+        case '(': {
+            // only plain and non-capturing groups; (?= and the like need backtracking
+            if (i < p.size() && p[i] == '?') {
+                if (i + 1 >= p.size() || p[i + 1] != ':') return nullptr;
+                i += 2;
+            }
+            std::unique_ptr<Node> inner = parseAlternate(p, i, depth + 1);
+            if (!inner || i >= p.size() || p[i] != ')') return nullptr;
+            ++i;
+            return inner;
+        }
+        case '[': {
+            std::bitset<256> set;
+            if (!parseClass(p, i, set)) return nullptr;
+            node->op = OP_CLASS;
+            node->x = m_classes.size();
+            m_classes.push_back(set);
+            return node;
+        }
+        case '.':
+            node->op = OP_ANY;
+            return node;
+        case '^':
+            node->op = OP_LINE_START;
+            return node;
+        case '$':
+            node->op = OP_LINE_END;
+            return node;
+        case '*':
+        case '+':
+        case '?':
+            return nullptr;
+        case '\\': {
+            if (i >= p.size()) return nullptr;
+            std::bitset<256> set;
+            if (p[i] == 'b' || p[i] == 'B') {
+                node->op = (p[i++] == 'b') ? OP_WORD : OP_NOT_WORD;
+                return node;
+            }
+            if (escapeClass(p[i], set)) {
+                ++i;
+                node->op = OP_CLASS;
+                node->x = m_classes.size();
+                m_classes.push_back(set);
+                return node;
+            }
+            int byte = escapeByte(p, i);
+            if (byte < 0) return nullptr;
+            node->x = byte;
+            return node;
+        }
+        default:
+            node->x = (uint8_t)c;
+            return node;
+    }
+}
+
+bool
+yano::Regex::parseClass(const std::string &p, size_t &i, std::bitset<256> &set)
+{
+    bool negate = i < p.size() && p[i] == '^';
+    if (negate) ++i;
+    int previous = -1;      // the last single byte, which a '-' may make a range from
+    while (i < p.size() && p[i] != ']') {
+        int byte;
+        if (p[i] == '\\') {
+            ++i;
+            if (i >= p.size()) return false;
+            std::bitset<256> escaped;
+            if (escapeClass(p[i], escaped)) {
+                ++i;
+                set |= escaped;
+                previous = -1;
+                continue;
+            }
+            if (p[i] == 'b') {
+                ++i;
+                byte = '\b';
+            } else {
+                byte = escapeByte(p, i);
+                if (byte < 0) return false;
+            }
+        } else if (p[i] == '-' && previous >= 0 && i + 1 < p.size() && p[i + 1] != ']') {
+            ++i;
+            int last;
+            if (p[i] == '\\') {
+                ++i;
+                if (i >= p.size()) return false;
+                last = escapeByte(p, i);
+                if (last < 0) return false;
+            } else {
+                last = (uint8_t)p[i++];
+            }
+            if (last < previous) return false;
+            for (int b = previous; b <= last; ++b) set.set(b);
+            previous = -1;
+            continue;
+        } else {
+            byte = (uint8_t)p[i++];
+        }
+        set.set(byte);
+        previous = byte;
+    }
+    if (i >= p.size()) return false;
+    ++i;    // ']'
+    if (negate) set.flip();
+    return true;
+}
+
+bool
+yano::Regex::escapeClass(char letter, std::bitset<256> &set)
+{
+    set.reset();
+    switch (letter | 0x20) {
+        case 'd':
+            for (int b = '0'; b <= '9'; ++b) set.set(b);
+            break;
+        case 'w':
+            for (int b = 0; b < 256; ++b) if (isWord((char)b)) set.set(b);
+            break;
+        case 's':
+            for (char b : { ' ', '\t', '\n', '\r', '\f', '\v' }) set.set((uint8_t)b);
+            break;
+        default:
+            return false;
+    }
+    // the upper case letter is the complement
+    if (letter >= 'A' && letter <= 'Z') set.flip();
+    return true;
+}
+
+int
+yano::Regex::escapeByte(const std::string &p, size_t &i)
+{
+    char c = p[i++];
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case '0': return '\0';
+        case 'x': {
+            if (i + 2 > p.size()) return -1;
+            int value = 0;
+            for (int k = 0; k < 2; ++k) {
+                char h = p[i++];
+                int digit = (h >= '0' && h <= '9') ? h - '0' : ((h | 0x20) >= 'a' && (h | 0x20) <= 'f') ? (h | 0x20) - 'a' + 10 : -1;
+                if (digit < 0) return -1;
+                value = value * 16 + digit;
+            }
+            return value;
+        }
+        default:
+            // a backreference, or a letter escape this engine does not know
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) return -1;
+            return (uint8_t)c;
+    }
+}
+
+bool
+yano::Regex::emit(const Node &node)
+{
+    if (m_program.size() > NFA_MAX_PROGRAM) return false;
+    switch (node.kind) {
+        case Node::ATOM:
+            add(node.op, node.x);
+            return true;
+        case Node::CONCAT:
+            for (const auto &child : node.children)
+                if (!emit(*child)) return false;
+            return true;
+        case Node::ALTERNATE: {
+            // split to each alternative in turn, all jumping past the last one
+            std::vector<uint32_t> jumps;
+            for (size_t k = 0; k < node.children.size(); ++k) {
+                uint32_t split = (k + 1 < node.children.size()) ? add(OP_SPLIT) : UINT32_MAX;
+                if (split != UINT32_MAX) m_program[split].x = split + 1;
+                if (!emit(*node.children[k])) return false;
+                if (split == UINT32_MAX) break;
+                jumps.push_back(add(OP_JUMP));
+                m_program[split].y = m_program.size();
+            }
+            for (uint32_t jump : jumps) m_program[jump].x = m_program.size();
+            return true;
+        }
+        case Node::REPEAT: {
+            const Node &body = *node.children[0];
+            for (int k = 0; k < node.min; ++k)
+                if (!emit(body)) return false;
+            if (node.max == -1) {
+                // loop: split into the body (or past it, first if lazy), then jump back
+                uint32_t split = add(OP_SPLIT);
+                if (!emit(body)) return false;
+                add(OP_JUMP, split);
+                uint32_t out = m_program.size();
+                m_program[split].x = node.greedy ? split + 1 : out;
+                m_program[split].y = node.greedy ? out : split + 1;
+                return true;
+            }
+            // each optional copy may be skipped to the end of all of them
+            std::vector<uint32_t> splits;
+            for (int k = node.min; k < node.max; ++k) {
+                splits.push_back(add(OP_SPLIT));
+                if (!emit(body)) return false;
+            }
+            uint32_t out = m_program.size();
+            for (uint32_t split : splits) {
+                m_program[split].x = node.greedy ? split + 1 : out;
+                m_program[split].y = node.greedy ? out : split + 1;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+yano::Regex::firstBytes()
+{
+    // walk every path from the start that consumes nothing; assertions only narrow the
+    // paths, so passing through them keeps the set an over-estimate
+    m_first.reset();
+    m_skip = true;
+    std::vector<bool> seen(m_program.size());
+    std::vector<uint32_t> stack = { 0 };
+    while (!stack.empty()) {
+        uint32_t pc = stack.back();
+        stack.pop_back();
+        if (seen[pc]) continue;
+        seen[pc] = true;
+        const Instruction &in = m_program[pc];
+        switch (in.op) {
+            case OP_CHAR:  m_first.set(in.x); break;
+            case OP_ANY:   m_first.set(); break;
+            case OP_CLASS: m_first |= m_classes[in.x]; break;
+            case OP_MATCH: m_skip = false; break;
+            case OP_JUMP:  stack.push_back(in.x); break;
+            case OP_SPLIT:
+                stack.push_back(in.y);
+                stack.push_back(in.x);
+                break;
+            default:       stack.push_back(pc + 1); break;
+        }
+    }
+    m_single = -1;
+    if (m_first.count() == 1)
+        for (int b = 0; b < 256; ++b)
+            if (m_first.test(b)) m_single = b;
+}
+
+void
+yano::Regex::follow(Scratch &scratch, std::vector<Scratch::Thread> &list, uint32_t pc, size_t start,
+                    Reader &text, size_t at) const
+{
+    // depth first with an explicit stack: the first target of a split, and all it leads
+    // to, goes into list ahead of the second
+    // \b and \B read the bytes around at only when there is one
+    auto boundary = [&text, at]() {
+        bool before = at > 0 && isWord(text.at(at - 1));
+        bool after = at < text.length && isWord(text.at(at));
+        return before != after;
+    };
+    scratch.stack.push_back(pc);
+    while (!scratch.stack.empty()) {
+        pc = scratch.stack.back();
+        scratch.stack.pop_back();
+        if (scratch.mark[pc] == scratch.generation) continue;
+        scratch.mark[pc] = scratch.generation;
+
+        const Instruction &in = m_program[pc];
+        switch (in.op) {
+            case OP_JUMP:
+                scratch.stack.push_back(in.x);
+                break;
+            case OP_SPLIT:
+                scratch.stack.push_back(in.y);
+                scratch.stack.push_back(in.x);
+                break;
+            case OP_LINE_START:
+                if (at == 0) scratch.stack.push_back(pc + 1);
+                break;
+            case OP_LINE_END:
+                if (at == text.length) scratch.stack.push_back(pc + 1);
+                break;
+            case OP_WORD:
+                if (boundary()) scratch.stack.push_back(pc + 1);
+                break;
+            case OP_NOT_WORD:
+                if (!boundary()) scratch.stack.push_back(pc + 1);
+                break;
+            default:
+                list.push_back({ pc, start });
+                break;
+        }
+    }
+}
+
+size_t
+yano::Regex::skip(Reader &text, size_t at) const
+{
+    while (at < text.length) {
+        text.seek(at);
+        const char *data = text.pieces[text.k].data + (at - text.base);
+        size_t n = text.pieces[text.k].length - (at - text.base);
+        if (m_single >= 0) {
+            const char *hit = (const char *)memchr(data, m_single, n);
+            if (hit) return at + (hit - data);
+        } else {
+            for (size_t i = 0; i < n; ++i)
+                if (m_first.test((uint8_t)data[i])) return at + i;
+        }
+        at += n;
+    }
+    return text.length;
+}
+
+bool
+yano::Regex::find(Reader &text, size_t from, bool anchored, bool not_empty,
+                  Scratch &scratch, size_t &start, size_t &end) const
+{
+    size_t length = text.length;
+    scratch.mark.resize(m_program.size());
+    scratch.current.clear();
+    ++scratch.generation;
+    bool matched = false;
+
+    for (size_t at = from; ; ++at) {
+        // a new thread starting here comes after every thread started earlier
+        if (!matched && (!anchored || at == from)) {
+            if (scratch.current.empty() && !anchored && m_skip) {
+                at = skip(text, at);
+                if (at == length) break;
+                // marks left from the position skipped from would hide pcs here
+                ++scratch.generation;
+            }
+            follow(scratch, scratch.current, 0, at, text, at);
+        }
+        if (scratch.current.empty()) {
+            // an assertion may have stopped this start; the next byte gets its own
+            if (matched || anchored || at >= length) break;
+            ++scratch.generation;
+            continue;
+        }
+
+        scratch.next.clear();
+        ++scratch.generation;
+        uint8_t c = (at < length) ? text.at(at) : 0;
+        for (const Scratch::Thread &thread : scratch.current) {
+            const Instruction &in = m_program[thread.pc];
+            bool step = false;
+            if (at < length) {
+                if (in.op == OP_CHAR) step = c == in.x;
+                else if (in.op == OP_ANY) step = c != '\n' && c != '\r';
+                else if (in.op == OP_CLASS) step = m_classes[in.x].test(c);
+            }
+            if (step) {
+                follow(scratch, scratch.next, thread.pc + 1, thread.start, text, at + 1);
+            } else if (in.op == OP_MATCH && (!not_empty || at > thread.start)) {
+                // the threads behind this one could only match with lower priority
+                matched = true;
+                start = thread.start;
+                end = at;
+                break;
+            }
+        }
+        scratch.current.swap(scratch.next);
+        if (at >= length) break;
+    }
+    return matched;
+}
+
+template <typename F>
+void
+yano::Regex::forEachMatch(const char *text, size_t length, Scratch &scratch, F fn) const
+{
+    Piece piece = { text, length };
+    forEachMatch(&piece, (length != 0) ? 1 : 0, scratch, fn);
+}
+
+template <typename F>
+void
+yano::Regex::forEachMatch(const Piece *pieces, size_t count, Scratch &scratch, F fn) const
+{
+    Reader text = { pieces, count, 0 };
+    for (size_t k = 0; k < count; ++k) text.length += pieces[k].length;
+    size_t length = text.length;
+    size_t from = 0;
+    while (from <= length) {
+        size_t start, end;
+        if (!find(text, from, false, false, scratch, start, end)) return;
+        if (end == start) {
+            // as std::regex_iterator does, try for a non-empty match right there before
+            // moving on a byte
+            if (find(text, start, true, true, scratch, start, end)) {
+                fn(start, end - start);
+                from = end;
+            } else {
+                from = start + 1;
+            }
+            continue;
+        }
+        fn(start, end - start);
+        from = end;
+    }
+}
+
+#endif
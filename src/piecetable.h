@@ -0,0 +1,716 @@
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "alloc.h"
+
+const uint64_t ADD_BLOCK_SIZE   = 1 << 16; // bytes per append-only block
+const uint64_t INDEX_CHUNK_SIZE = 1 << 20; // bytes of a file scanned for newlines at a time
+const uint64_t TAIL_BLOCK_SIZE  = 1 << 24; // bytes per block that text appended to the file is read into
+const uint32_t NO_BLOCK         = UINT32_MAX;
+
+/* Design of yano::PieceTable:
+    1. Text lives in immutable buffers: fixed-size append-only blocks that typed text is
+       copied into. Blocks never move once allocated, so pointers into them stay valid.
+    2. The document is a sequence of pieces (buffer, start, length) kept in a treap
+       ordered by position. Every node caches the byte and newline totals of its
+       subtree, so offset and row lookups are O(log n) descents.
+    3. Each buffer records the offsets of its own newlines, so the newlines inside any
+       part of a piece are counted with two binary searches instead of a scan.
+       Nodes come from a Pool, so splitting pieces while typing reuses freed nodes.
+    4. Typing at the end of the most recent insertion extends that piece in place
+       rather than adding a node per keystroke.
+    5. An opened file is mapped read-only and used as a buffer without copying. Its
+       newlines are found lazily: the unscanned remainder waits at the end of the
+       document and is moved into the treap a chunk at a time, only as far as a query
+       needs. Saving streams the pieces out without scanning anything.
+    6. The chunks can also be scanned ahead of time on another thread (see
+       LineIndexer) and handed over with adoptChunk(), which skips the scan.
+    7. Bytes a file gains after opening (see Tail) are read into blocks of their own,
+       apart from typed text, and queued after the unscanned remainder. They are
+       indexed like the rest of the file, and nothing already taken in is read again.
+       A file that may be truncated under the editor is read the same way when opened,
+       since touching a mapped page past a file's new end raises SIGBUS.
+*/
+
+namespace yano
+{
+    class PieceTable
+    {
+        public:
+            // a run of one buffer; buffers are never changed or freed until the table is
+            // reopened, so a Span stays readable even after its text is erased
+            typedef struct Span {
+                uint32_t  buffer;
+                uint64_t  start;
+                uint64_t  length;
+            } Span;
+
+            PieceTable();
+            ~PieceTable();
+
+            // replace the contents with a read-only mapping of path, or with a copy read
+            // into blocks of its own if map is false; a missing file leaves the table
+            // empty. Returns false if path exists but cannot be mapped or read
+            bool     open(const char *path, bool map = true);
+            // write the contents to a temporary file beside path, then rename it over path
+            bool     save(const char *path);
+
+            void     insert(uint64_t offset, const char *text, uint64_t length);
+            void     erase(uint64_t offset, uint64_t length);
+
+            uint64_t length();                      // total bytes
+            uint64_t lineCount();                   // number of '\n' + 1 seen so far
+            bool     fullyIndexed() { return m_unindexed.empty(); }
+            bool     mapsFile() { return !m_buffers.empty() && m_buffers[0].mapped; }   // only open() maps
+            uint64_t lineStart(uint64_t row);       // offset of the first byte of row
+            uint64_t lineLength(uint64_t row);      // bytes in row, excluding its '\n'
+            uint64_t rowOf(uint64_t offset);        // row that offset falls on
+            char     charAt(uint64_t offset);
+
+            // copy [offset, offset + length) into out; returns the number of bytes copied
+            uint64_t read(uint64_t offset, char *out, uint64_t length);
+
+            // call fn(const char *data, uint64_t length) for each contiguous run of bytes in
+            // [offset, offset + length), in document order; fn returns false to stop early
+            template <typename F>
+            void     forEachSpan(uint64_t offset, uint64_t length, F fn);
+
+            // call fn(const char *data, uint64_t length) for every run of the whole document in
+            // order without indexing anything. The pointers stay valid, even across later
+            // edits, until the table is reopened
+            template <typename F>
+            void     forEachRun(F fn);
+
+            // append the pieces that make up [offset, offset + length) to out
+            void     pieces(uint64_t offset, uint64_t length, std::vector<Span> &out);
+            // call fn(uint32_t buffer, uint64_t start, const char *data, uint64_t length) for
+            // each run not scanned for newlines yet, in order. The runs never change, so
+            // another thread may scan data while the table is in use
+            template <typename F>
+            void     forEachUnindexed(F fn);
+            // take the next unscanned chunk, starting at start in buffer, into the index with
+            // its newlines found elsewhere. False if that chunk was already scanned here
+            bool     adoptChunk(uint32_t buffer, uint64_t start, uint64_t length,
+                                const std::vector<uint64_t> &newlines);
+
+            // put pieces back at offset without copying their text; O(count log n)
+            void     insertPieces(uint64_t offset, const Span *pieces, size_t count);
+
+            // read up to length bytes of fd from offset onto the end of the text, unscanned;
+            // returns the number of bytes appended
+            uint64_t appendFrom(int fd, uint64_t offset, uint64_t length);
+
+        private:
+            typedef struct Buffer {
+                char                  *data;
+                uint64_t               size;
+                uint64_t               capacity;
+                std::vector<uint64_t>  newlines;    // offsets of every '\n' in the scanned part
+                bool                   mapped;      // munmap rather than free
+            } Buffer;
+
+            typedef struct Node {
+                uint32_t  buffer;
+                uint64_t  start;
+                uint64_t  length;
+                uint64_t  newlines;
+                uint64_t  sub_length;               // totals over this subtree
+                uint64_t  sub_newlines;
+                uint32_t  priority;
+                Node     *left;
+                Node     *right;
+            } Node;
+
+            std::vector<Buffer>  m_buffers;
+            Pool<Node>           m_nodes;
+            Node                *m_root = nullptr;
+            std::deque<Span>     m_unindexed;          // not scanned for newlines yet; follows the treap
+            uint64_t             m_unindexed_length = 0;
+            uint32_t             m_add_block = NO_BLOCK;   // block typed text is copied into
+            uint32_t             m_tail_block = NO_BLOCK;  // block appendFrom() reads into
+            uint32_t             m_seed = 2463534242u;
+
+            uint32_t nextPriority() {
+                // xorshift32; only needs to be cheap and well spread
+                m_seed ^= m_seed << 13;
+                m_seed ^= m_seed >> 17;
+                m_seed ^= m_seed << 5;
+                return m_seed;
+            }
+
+            static uint64_t subLength(Node *t)   { return t ? t->sub_length : 0; }
+            static uint64_t subNewlines(Node *t) { return t ? t->sub_newlines : 0; }
+            static void update(Node *t) {
+                t->sub_length = subLength(t->left) + t->length + subLength(t->right);
+                t->sub_newlines = subNewlines(t->left) + t->newlines + subNewlines(t->right);
+            }
+
+            // newlines in buffer[begin, end)
+            uint64_t countNewlines(uint32_t buffer, uint64_t begin, uint64_t end) {
+                const std::vector<uint64_t> &nl = m_buffers[buffer].newlines;
+                return std::lower_bound(nl.begin(), nl.end(), end) -
+                       std::lower_bound(nl.begin(), nl.end(), begin);
+            }
+
+            Node *makeNode(uint32_t buffer, uint64_t start, uint64_t length);
+            void  destroy(Node *t);
+            void  split(Node *t, uint64_t offset, Node *&left, Node *&right);
+            Node *merge(Node *left, Node *right);
+            bool  extendLast(Node *t, uint32_t buffer, uint64_t start, uint64_t length);
+            uint32_t appendBlock(const char *text, uint64_t &length, uint64_t &start);
+            void  clear();
+
+            // move unscanned text into the treap until it holds offset bytes / row newlines
+            bool  indexChunk();
+            void  indexFront(uint64_t length);
+            void  indexTo(uint64_t offset) {
+                while (subLength(m_root) < offset && indexChunk());
+            }
+            void  indexRows(uint64_t row) {
+                while (subNewlines(m_root) < row && indexChunk());
+            }
+
+            template <typename F>
+            bool  spans(Node *t, uint64_t base, uint64_t begin, uint64_t end, F &fn);
+            void  pieceSpans(Node *t, uint64_t base, uint64_t begin, uint64_t end, std::vector<Span> &out);
+    };
+};
+
+yano::PieceTable::PieceTable()
+{
+}
+
+yano::PieceTable::~PieceTable()
+{
+    clear();
+}
+
+bool
+yano::PieceTable::open(const char *path, bool map)
+{
+    clear();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) return errno == ENOENT;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    if (!map) {
+        // read as if appended, so the text is indexed the same way
+        bool read = appendFrom(fd, 0, st.st_size) == (uint64_t)st.st_size;
+        close(fd);
+        return read;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);      // the mapping keeps the file alive
+    if (data == MAP_FAILED) return false;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    Buffer file;
+    file.data = (char *)data;
+    file.size = st.st_size;
+    file.capacity = st.st_size;
+    file.mapped = true;
+    m_buffers.push_back(std::move(file));
+
+    m_unindexed.push_back({ (uint32_t)(m_buffers.size() - 1), 0, (uint64_t)st.st_size });
+    m_unindexed_length = st.st_size;
+    return true;
+}
+
+bool
+yano::PieceTable::save(const char *path)
+{
+    std::string tmp_path = std::string(path) + ".XXXXXX";
+    int fd = mkstemp(&tmp_path[0]);
+    if (fd == -1) return false;
+
+    // keep the permissions of the file being replaced
+    struct stat st;
+    if (stat(path, &st) == 0)
+        fchmod(fd, st.st_mode & 07777);
+    else
+        fchmod(fd, 0644);
+
+    bool ok = true;
+    auto write_all = [&](const char *data, uint64_t n) {
+        while (n > 0) {
+            ssize_t written = write(fd, data, n);
+            if (written == -1) {
+                if (errno == EINTR) continue;
+                ok = false;
+                return false;
+            }
+            data += written;
+            n -= written;
+        }
+        return true;
+    };
+
+    // stream pieces straight from their buffers; unscanned text is written as-is
+    spans(m_root, 0, 0, subLength(m_root), write_all);
+    for (const Span &span : m_unindexed) {
+        if (!ok) break;
+        write_all(m_buffers[span.buffer].data + span.start, span.length);
+    }
+
+    if (ok) ok = fsync(fd) == 0;
+    if (close(fd) != 0) ok = false;
+    if (ok) ok = rename(tmp_path.c_str(), path) == 0;
+    if (!ok) unlink(tmp_path.c_str());
+    return ok;
+}
+
+void
+yano::PieceTable::insert(uint64_t offset, const char *text, uint64_t length)
+{
+    offset = std::min(offset, this->length());
+    indexTo(offset);
+    while (length > 0) {
+        // a block may fill up partway through; the rest goes into a new piece
+        uint64_t n = length, start;
+        uint32_t buffer = appendBlock(text, n, start);
+
+        Node *left, *right;
+        split(m_root, offset, left, right);
+        if (!extendLast(left, buffer, start, n))
+            left = merge(left, makeNode(buffer, start, n));
+        m_root = merge(left, right);
+
+        offset += n;
+        text += n;
+        length -= n;
+    }
+}
+
+void
+yano::PieceTable::erase(uint64_t offset, uint64_t length)
+{
+    indexTo(offset + length);
+
+    Node *left, *middle, *right;
+    split(m_root, offset, left, middle);
+    split(middle, length, middle, right);
+    destroy(middle);
+    m_root = merge(left, right);
+}
+
+uint64_t
+yano::PieceTable::length()
+{
+    return subLength(m_root) + m_unindexed_length;
+}
+
+uint64_t
+yano::PieceTable::lineCount()
+{
+    return subNewlines(m_root) + 1;
+}
+
+uint64_t
+yano::PieceTable::lineStart(uint64_t row)
+{
+    if (row == 0) return 0;
+    indexRows(row);
+    if (row > subNewlines(m_root)) return length();
+
+    // find the row-th newline; the line starts just past it
+    uint64_t k = row, offset = 0;
+    Node *t = m_root;
+    while (t) {
+        if (k <= subNewlines(t->left)) {
+            t = t->left;
+            continue;
+        }
+        k -= subNewlines(t->left);
+        offset += subLength(t->left);
+        if (k <= t->newlines) {
+            const std::vector<uint64_t> &nl = m_buffers[t->buffer].newlines;
+            size_t first = std::lower_bound(nl.begin(), nl.end(), t->start) - nl.begin();
+            return offset + (nl[first + k - 1] - t->start) + 1;
+        }
+        k -= t->newlines;
+        offset += t->length;
+        t = t->right;
+    }
+    return length();
+}
+
+uint64_t
+yano::PieceTable::lineLength(uint64_t row)
+{
+    uint64_t begin = lineStart(row);
+    indexRows(row + 1);
+    uint64_t end = (row + 1 < lineCount()) ? lineStart(row + 1) - 1 : length();
+    return end - begin;
+}
+
+uint64_t
+yano::PieceTable::rowOf(uint64_t offset)
+{
+    indexTo(offset);
+
+    uint64_t row = 0;
+    Node *t = m_root;
+    while (t) {
+        if (offset < subLength(t->left)) {
+            t = t->left;
+            continue;
+        }
+        row += subNewlines(t->left);
+        offset -= subLength(t->left);
+        if (offset <= t->length)
+            return row + countNewlines(t->buffer, t->start, t->start + offset);
+        row += t->newlines;
+        offset -= t->length;
+        t = t->right;
+    }
+    return row;
+}
+
+char
+yano::PieceTable::charAt(uint64_t offset)
+{
+    indexTo(offset + 1);
+
+    Node *t = m_root;
+    while (t) {
+        if (offset < subLength(t->left)) {
+            t = t->left;
+            continue;
+        }
+        offset -= subLength(t->left);
+        if (offset < t->length)
+            return m_buffers[t->buffer].data[t->start + offset];
+        offset -= t->length;
+        t = t->right;
+    }
+    return '\0';
+}
+
+uint64_t
+yano::PieceTable::read(uint64_t offset, char *out, uint64_t length)
+{
+    uint64_t copied = 0;
+    forEachSpan(offset, length, [&](const char *data, uint64_t n) {
+        memcpy(out + copied, data, n);
+        copied += n;
+        return true;
+    });
+    return copied;
+}
+
+template <typename F>
+void
+yano::PieceTable::forEachSpan(uint64_t offset, uint64_t length, F fn)
+{
+    indexTo(offset + length);
+    spans(m_root, 0, offset, offset + length, fn);
+}
+
+template <typename F>
+void
+yano::PieceTable::forEachRun(F fn)
+{
+    spans(m_root, 0, 0, subLength(m_root), fn);
+    for (const Span &span : m_unindexed)
+        fn((const char *)m_buffers[span.buffer].data + span.start, span.length);
+}
+
+void
+yano::PieceTable::pieces(uint64_t offset, uint64_t length, std::vector<Span> &out)
+{
+    indexTo(offset + length);
+    pieceSpans(m_root, 0, offset, offset + length, out);
+}
+
+void
+yano::PieceTable::insertPieces(uint64_t offset, const Span *pieces, size_t count)
+{
+    offset = std::min(offset, length());
+    indexTo(offset);
+
+    // pieces come from the treap, so their buffers' newlines are already indexed
+    Node *middle = nullptr;
+    for (size_t i = 0; i < count; ++i)
+        middle = merge(middle, makeNode(pieces[i].buffer, pieces[i].start, pieces[i].length));
+
+    Node *left, *right;
+    split(m_root, offset, left, right);
+    m_root = merge(merge(left, middle), right);
+}
+
+void
+yano::PieceTable::pieceSpans(Node *t, uint64_t base, uint64_t begin, uint64_t end, std::vector<Span> &out)
+{
+    if (!t || base >= end || base + t->sub_length <= begin) return;
+    pieceSpans(t->left, base, begin, end, out);
+
+    uint64_t pos = base + subLength(t->left);
+    uint64_t lo = std::max(pos, begin);
+    uint64_t hi = std::min(pos + t->length, end);
+    if (lo < hi) out.push_back({ t->buffer, t->start + (lo - pos), hi - lo });
+
+    pieceSpans(t->right, pos + t->length, begin, end, out);
+}
+
+template <typename F>
+bool
+yano::PieceTable::spans(Node *t, uint64_t base, uint64_t begin, uint64_t end, F &fn)
+{
+    // prune subtrees entirely outside [begin, end)
+    if (!t || base >= end || base + t->sub_length <= begin) return true;
+    if (!spans(t->left, base, begin, end, fn)) return false;
+
+    uint64_t pos = base + subLength(t->left);
+    uint64_t lo = std::max(pos, begin);
+    uint64_t hi = std::min(pos + t->length, end);
+    if (lo < hi && !fn((const char *)m_buffers[t->buffer].data + t->start + (lo - pos), hi - lo))
+        return false;
+
+    return spans(t->right, pos + t->length, begin, end, fn);
+}
+
+yano::PieceTable::Node *
+yano::PieceTable::makeNode(uint32_t buffer, uint64_t start, uint64_t length)
+{
+    Node *t = new (m_nodes.allocate()) Node;
+    t->buffer = buffer;
+    t->start = start;
+    t->length = length;
+    t->newlines = countNewlines(buffer, start, start + length);
+    t->priority = nextPriority();
+    t->left = t->right = nullptr;
+    update(t);
+    return t;
+}
+
+void
+yano::PieceTable::destroy(Node *t)
+{
+    if (!t) return;
+    destroy(t->left);
+    destroy(t->right);
+    m_nodes.release(t);
+}
+
+void
+yano::PieceTable::split(Node *t, uint64_t offset, Node *&left, Node *&right)
+{
+    // left receives the first offset bytes, right the rest
+    if (!t) {
+        left = right = nullptr;
+        return;
+    }
+
+    uint64_t left_length = subLength(t->left);
+    if (offset <= left_length) {
+        split(t->left, offset, left, t->left);
+        right = t;
+    } else if (offset >= left_length + t->length) {
+        split(t->right, offset - left_length - t->length, t->right, right);
+        left = t;
+    } else {
+        // offset falls inside this piece: cut it in two
+        uint64_t cut = offset - left_length;
+        Node *tail = makeNode(t->buffer, t->start + cut, t->length - cut);
+        t->length = cut;
+        t->newlines -= tail->newlines;
+        right = merge(tail, t->right);
+        t->right = nullptr;
+        left = t;
+    }
+    update(t);
+}
+
+yano::PieceTable::Node *
+yano::PieceTable::merge(Node *left, Node *right)
+{
+    if (!left) return right;
+    if (!right) return left;
+    if (left->priority > right->priority) {
+        left->right = merge(left->right, right);
+        update(left);
+        return left;
+    }
+    right->left = merge(left, right->left);
+    update(right);
+    return right;
+}
+
+bool
+yano::PieceTable::extendLast(Node *t, uint32_t buffer, uint64_t start, uint64_t length)
+{
+    // grow the rightmost piece of t if the new bytes directly follow it in the same buffer
+    if (!t) return false;
+    if (t->right) {
+        if (!extendLast(t->right, buffer, start, length)) return false;
+    } else {
+        if (t->buffer != buffer || t->start + t->length != start) return false;
+        t->length += length;
+        t->newlines += countNewlines(buffer, start, start + length);
+    }
+    update(t);
+    return true;
+}
+
+uint32_t
+yano::PieceTable::appendBlock(const char *text, uint64_t &length, uint64_t &start)
+{
+    // copies as much of text as fits into the current block; length is trimmed to that
+    if (m_add_block == NO_BLOCK || m_buffers[m_add_block].size == m_buffers[m_add_block].capacity) {
+        Buffer block;
+        block.data = (char *)malloc(ADD_BLOCK_SIZE);
+        block.size = 0;
+        block.capacity = ADD_BLOCK_SIZE;
+        block.mapped = false;
+        m_buffers.push_back(std::move(block));
+        m_add_block = m_buffers.size() - 1;
+    }
+
+    Buffer &b = m_buffers[m_add_block];
+    length = std::min(length, b.capacity - b.size);
+    start = b.size;
+    memcpy(b.data + start, text, length);
+    for (uint64_t i = 0; i < length; ++i)
+        if (text[i] == '\n')
+            b.newlines.push_back(start + i);
+    b.size += length;
+    return m_add_block;
+}
+
+uint64_t
+yano::PieceTable::appendFrom(int fd, uint64_t offset, uint64_t length)
+{
+    uint64_t appended = 0;
+    while (appended < length) {
+        if (m_tail_block == NO_BLOCK || m_buffers[m_tail_block].size == m_buffers[m_tail_block].capacity) {
+            Buffer block;
+            block.data = (char *)malloc(TAIL_BLOCK_SIZE);
+            block.size = 0;
+            block.capacity = TAIL_BLOCK_SIZE;
+            block.mapped = false;
+            m_buffers.push_back(std::move(block));
+            m_tail_block = m_buffers.size() - 1;
+        }
+
+        // only the unused end of the block is written, so runs handed to other threads
+        // stay as they were
+        Buffer &b = m_buffers[m_tail_block];
+        ssize_t n = pread(fd, b.data + b.size, std::min(length - appended, b.capacity - b.size),
+                          offset + appended);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        Span *last = m_unindexed.empty() ? nullptr : &m_unindexed.back();
+        if (last && last->buffer == m_tail_block && last->start + last->length == b.size)
+            last->length += n;
+        else
+            m_unindexed.push_back({ m_tail_block, b.size, (uint64_t)n });
+        b.size += n;
+        m_unindexed_length += n;
+        appended += n;
+    }
+    return appended;
+}
+
+void
+yano::PieceTable::clear()
+{
+    destroy(m_root);
+    m_root = nullptr;
+    for (Buffer &b : m_buffers) {
+        if (b.mapped)
+            munmap(b.data, b.size);
+        else
+            free(b.data);
+    }
+    m_buffers.clear();
+    m_unindexed.clear();
+    m_unindexed_length = 0;
+    m_add_block = NO_BLOCK;
+    m_tail_block = NO_BLOCK;
+}
+
+bool
+yano::PieceTable::indexChunk()
+{
+    if (m_unindexed.empty()) return false;
+
+    Span &span = m_unindexed.front();
+    Buffer &b = m_buffers[span.buffer];
+    uint64_t n = std::min(span.length, INDEX_CHUNK_SIZE);
+
+    const char *p = b.data + span.start;
+    const char *end = p + n;
+    while ((p = (const char *)memchr(p, '\n', end - p)) != NULL) {
+        b.newlines.push_back(p - b.data);
+        ++p;
+    }
+    indexFront(n);
+    return true;
+}
+
+template <typename F>
+void
+yano::PieceTable::forEachUnindexed(F fn)
+{
+    for (const Span &span : m_unindexed)
+        fn(span.buffer, span.start, (const char *)m_buffers[span.buffer].data + span.start, span.length);
+}
+
+bool
+yano::PieceTable::adoptChunk(uint32_t buffer, uint64_t start, uint64_t length,
+                             const std::vector<uint64_t> &newlines)
+{
+    // chunks are cut the same way indexChunk() cuts them, so a chunk scanned elsewhere
+    // either is the next one or was already taken in here on demand
+    if (m_unindexed.empty()) return false;
+    const Span &span = m_unindexed.front();
+    if (span.buffer != buffer || span.start != start || span.length < length) return false;
+
+    std::vector<uint64_t> &nl = m_buffers[buffer].newlines;
+    nl.insert(nl.end(), newlines.begin(), newlines.end());
+    indexFront(length);
+    return true;
+}
+
+void
+yano::PieceTable::indexFront(uint64_t length)
+{
+    // the front span's newlines are already recorded; scanned text always lands at the
+    // very end of the document
+    Span &span = m_unindexed.front();
+    if (!extendLast(m_root, span.buffer, span.start, length))
+        m_root = merge(m_root, makeNode(span.buffer, span.start, length));
+
+    span.start += length;
+    span.length -= length;
+    m_unindexed_length -= length;
+    if (span.length == 0) m_unindexed.pop_front();
+}
+
+#endif
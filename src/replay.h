@@ -0,0 +1,96 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "backend.h"
+
+/* Design of session recording and replay:
+    1. A session is a text file with one key per line: "time_us keycode state", the
+       time counted from the session's first key. Lines starting with '#' are
+       comments. Keys that arrived in one pollEvents() batch share a time, so a
+       replay can hand them to the editor in the same batches.
+    2. SessionRecorder appends each batch as it is handled (Yano records when
+       $YANO_RECORD names a file). loadSession() reads a session back for
+       bench/replay.cpp, which plays it through any pw::Backend with pushKey().
+*/
+
+namespace yano
+{
+    typedef struct ReplayEvent {
+        uint64_t      time_us;      // since the first key of the session
+        pw::KeyEvent  key;
+    } ReplayEvent;
+
+    // false if path cannot be read or a line is malformed
+    bool loadSession(const char *path, std::vector<ReplayEvent> &events);
+
+    class SessionRecorder
+    {
+        public:
+            ~SessionRecorder() { close(); }
+
+            bool open(const char *path);
+            void close();
+            bool isOpen() { return m_file != NULL; }
+
+            // one batch of keys, as pollEvents() delivered it at now_ns (Metrics::now())
+            void record(const std::vector<pw::KeyEvent> &keys, uint64_t now_ns);
+
+        private:
+            FILE      *m_file = NULL;
+            uint64_t   m_start_ns = 0;
+    };
+};
+
+bool
+yano::loadSession(const char *path, std::vector<ReplayEvent> &events)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return false;
+
+    char line[128];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        unsigned long long time;
+        unsigned keycode, state;
+        ok = sscanf(line, "%llu %u %u", &time, &keycode, &state) == 3 && keycode < 256 && state < 65536;
+        if (ok) events.push_back({ time, { (uint8_t)keycode, (uint16_t)state } });
+    }
+    fclose(file);
+    return ok;
+}
+
+bool
+yano::SessionRecorder::open(const char *path)
+{
+    close();
+    m_file = fopen(path, "w");
+    if (m_file == NULL) return false;
+    m_start_ns = 0;
+    fprintf(m_file, "# yano session: time_us keycode state\n");
+    return true;
+}
+
+void
+yano::SessionRecorder::close()
+{
+    if (m_file) fclose(m_file);
+    m_file = NULL;
+}
+
+void
+yano::SessionRecorder::record(const std::vector<pw::KeyEvent> &keys, uint64_t now_ns)
+{
+    if (m_file == NULL || keys.empty()) return;
+    if (m_start_ns == 0) m_start_ns = now_ns;
+    unsigned long long time = (now_ns - m_start_ns) / 1000;
+    for (const pw::KeyEvent &key : keys)
+        fprintf(m_file, "%llu %u %u\n", time, key.keycode, key.state);
+    fflush(m_file);     // a session that ends in a crash is the one worth having
+}
+
+#endif
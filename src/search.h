@@ -0,0 +1,288 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nfa.h"
+#include "piecetable.h"
+#include "threadpool.h"
+
+const uint64_t SEARCH_CHUNK_SIZE = 1 << 20;    // bytes of text per task
+
+/* Design of yano::Search:
+    1. start() takes a snapshot of the PieceTable: the (pointer, length) of every run
+       of text, in order. Buffers never change or move, so workers read the text where
+       it lies while the editor keeps editing; nothing is flattened or copied.
+    2. The document is cut into SEARCH_CHUNK_SIZE chunks. Pool workers take chunks in
+       order off an atomic counter and record the matches that start in them.
+    3. Literals are found with memmem (a SIMD memchr for the first byte, then two-way)
+       inside each run. Only matches that straddle two runs are searched in a small
+       copy of the bytes around the seam.
+    4. Regexes are matched a line at a time; a chunk owns the lines that start in it,
+       and looks for the first of them no further than its end. A line that spans
+       runs is handed to the regex engine (nfa.h) as those runs' pieces of it, so it
+       is never copied, and the engine needs no stack however long the line.
+    5. poll() hands over the matches of finished chunks, stopping at the first chunk
+       still running, so results arrive in document order as soon as they are known.
+*/
+
+namespace yano
+{
+    typedef struct Match {
+        uint64_t  offset;
+        uint64_t  length;
+    } Match;
+
+    class Search
+    {
+        public:
+            explicit Search(ThreadPool &pool) : m_pool(pool) {}
+            ~Search() { cancel(); }
+
+            // search text for pattern, replacing any search in progress. progress is called
+            // from a worker each time a chunk finishes. False if the regex does not compile
+            bool start(PieceTable &text, const std::string &pattern, bool regex,
+                       std::function<void()> progress);
+            // append matches that are ready, in document order; true once all are delivered
+            bool poll(std::vector<Match> &out);
+            // block until every chunk is searched
+            void wait();
+            // stop the workers and wait for them; required before the text is reopened
+            void cancel();
+
+        private:
+            typedef struct Run {
+                const char *data;
+                uint64_t    offset;         // in the document
+                uint64_t    length;
+            } Run;
+
+            typedef struct Chunk {
+                std::vector<Match>  matches;
+                std::atomic<bool>   done{false};
+            } Chunk;
+
+            ThreadPool                &m_pool;
+            std::vector<Run>           m_runs;
+            uint64_t                   m_length = 0;
+            std::string                m_pattern;
+            std::unique_ptr<Regex>     m_regex;
+            std::function<void()>      m_progress;
+
+            std::unique_ptr<Chunk[]>   m_chunks;
+            size_t                     m_chunk_count = 0;
+            size_t                     m_delivered = 0;
+            std::atomic<size_t>        m_next{0};
+            std::atomic<bool>          m_cancel{false};
+
+            std::mutex                 m_idle_lock;
+            std::condition_variable    m_idle;
+            int                        m_active = 0;   // workers still running
+
+            void work();
+            void scanLiteral(uint64_t begin, uint64_t end, std::vector<Match> &out);
+            void scanRegex(uint64_t begin, uint64_t end, std::vector<Match> &out);
+            // index of the run holding offset
+            size_t runAt(uint64_t offset);
+            // copy [offset, offset + length) of the document into out; returns bytes copied
+            uint64_t copy(uint64_t offset, uint64_t length, char *out);
+            // offset of the first c in [offset, limit), or limit
+            uint64_t find(uint64_t offset, uint64_t limit, char c);
+    };
+};
+
+bool
+yano::Search::start(PieceTable &text, const std::string &pattern, bool regex,
+                    std::function<void()> progress)
+{
+    cancel();
+
+    m_regex.reset();
+    if (regex) {
+        m_regex.reset(new Regex());
+        if (!m_regex->compile(pattern)) {
+            m_regex.reset();
+            return false;
+        }
+    }
+    m_pattern = pattern;
+    m_progress = progress;
+
+    m_runs.clear();
+    m_length = 0;
+    text.forEachRun([this](const char *data, uint64_t length) {
+        m_runs.push_back({ data, m_length, length });
+        m_length += length;
+        return true;
+    });
+
+    m_chunk_count = (m_length + SEARCH_CHUNK_SIZE - 1) / SEARCH_CHUNK_SIZE;
+    m_chunks.reset(new Chunk[m_chunk_count]);
+    m_delivered = 0;
+    m_next = 0;
+    m_cancel = false;
+    if (m_pattern.empty()) m_chunk_count = 0;
+
+    unsigned workers = std::min<size_t>(m_pool.size(), m_chunk_count);
+    m_active = workers;
+    for (unsigned i = 0; i < workers; ++i)
+        m_pool.submit([this] { work(); });
+    return true;
+}
+
+bool
+yano::Search::poll(std::vector<Match> &out)
+{
+    while (m_delivered < m_chunk_count && m_chunks[m_delivered].done.load(std::memory_order_acquire)) {
+        std::vector<Match> &matches = m_chunks[m_delivered++].matches;
+        out.insert(out.end(), matches.begin(), matches.end());
+        std::vector<Match>().swap(matches);
+    }
+    return m_delivered == m_chunk_count;
+}
+
+void
+yano::Search::wait()
+{
+    std::unique_lock<std::mutex> lock(m_idle_lock);
+    m_idle.wait(lock, [this] { return m_active == 0; });
+}
+
+void
+yano::Search::cancel()
+{
+    m_cancel = true;
+    wait();
+}
+
+void
+yano::Search::work()
+{
+    for (;;) {
+        size_t k = m_next.fetch_add(1);
+        if (k >= m_chunk_count || m_cancel.load(std::memory_order_relaxed)) break;
+
+        uint64_t begin = k * SEARCH_CHUNK_SIZE;
+        uint64_t end = std::min(begin + SEARCH_CHUNK_SIZE, m_length);
+        if (m_regex)
+            scanRegex(begin, end, m_chunks[k].matches);
+        else
+            scanLiteral(begin, end, m_chunks[k].matches);
+        m_chunks[k].done.store(true, std::memory_order_release);
+        if (m_progress) m_progress();
+    }
+
+    std::lock_guard<std::mutex> lock(m_idle_lock);
+    if (--m_active == 0) m_idle.notify_all();
+}
+
+void
+yano::Search::scanLiteral(uint64_t begin, uint64_t end, std::vector<Match> &out)
+{
+    const char *needle = m_pattern.data();
+    uint64_t n = m_pattern.size();
+    std::string seam;
+
+    for (size_t i = runAt(begin); i < m_runs.size() && m_runs[i].offset < end; ++i) {
+        const Run &run = m_runs[i];
+        uint64_t from = std::max(begin, run.offset);
+        uint64_t run_end = run.offset + run.length;
+
+        // starts whose match lies entirely inside this run
+        uint64_t inside = (run.length >= n) ? std::min(end, run_end - n + 1) : from;
+        if (from < inside) {
+            const char *p = run.data + (from - run.offset);
+            const char *last = run.data + (inside - run.offset);     // one past the last start
+            while (p < last) {
+                const char *hit = (const char *)memmem(p, (last - p) + n - 1, needle, n);
+                if (hit == NULL) break;
+                out.push_back({ run.offset + (hit - run.data), n });
+                p = hit + 1;
+            }
+        }
+
+        // starts within n - 1 bytes of the run's end reach into the runs after it
+        uint64_t seam_begin = std::max(from, inside);
+        uint64_t seam_end = std::min(end, run_end);
+        if (seam_begin < seam_end && run_end < m_length) {
+            seam.resize(seam_end - seam_begin + n - 1);
+            uint64_t got = copy(seam_begin, seam.size(), &seam[0]);
+            for (uint64_t s = 0; s < seam_end - seam_begin && s + n <= got; ++s)
+                if (memcmp(&seam[s], needle, n) == 0)
+                    out.push_back({ seam_begin + s, n });
+        }
+    }
+}
+
+void
+yano::Search::scanRegex(uint64_t begin, uint64_t end, std::vector<Match> &out)
+{
+    std::vector<Regex::Piece> pieces;
+    Regex::Scratch scratch;
+    // the chunk owns the lines starting in [begin, end); in the middle of a long line
+    // there are none, and the search for one stops at end
+    uint64_t line = (begin == 0) ? 0 : find(begin - 1, end - 1, '\n') + 1;
+    while (line < end && line < m_length) {
+        uint64_t line_end = find(line, m_length, '\n');
+
+        pieces.clear();
+        for (size_t i = runAt(line); i < m_runs.size() && m_runs[i].offset < line_end; ++i) {
+            const Run &run = m_runs[i];
+            uint64_t from = std::max(line, run.offset);
+            uint64_t to = std::min(line_end, run.offset + run.length);
+            if (from < to) pieces.push_back({ run.data + (from - run.offset), (size_t)(to - from) });
+        }
+
+        m_regex->forEachMatch(pieces.data(), pieces.size(), scratch, [&](size_t start, size_t length) {
+            out.push_back({ line + start, length });
+        });
+        line = line_end + 1;
+    }
+}
+
+size_t
+yano::Search::runAt(uint64_t offset)
+{
+    auto it = std::upper_bound(m_runs.begin(), m_runs.end(), offset,
+                               [](uint64_t o, const Run &run) { return o < run.offset; });
+    return (it == m_runs.begin()) ? 0 : (it - m_runs.begin()) - 1;
+}
+
+uint64_t
+yano::Search::copy(uint64_t offset, uint64_t length, char *out)
+{
+    uint64_t copied = 0;
+    for (size_t i = runAt(offset); i < m_runs.size() && copied < length; ++i) {
+        const Run &run = m_runs[i];
+        uint64_t from = offset + copied - run.offset;
+        uint64_t n = std::min(length - copied, run.length - from);
+        memcpy(out + copied, run.data + from, n);
+        copied += n;
+    }
+    return copied;
+}
+
+uint64_t
+yano::Search::find(uint64_t offset, uint64_t limit, char c)
+{
+    for (size_t i = runAt(offset); i < m_runs.size() && m_runs[i].offset < limit; ++i) {
+        const Run &run = m_runs[i];
+        uint64_t from = std::max(offset, run.offset) - run.offset;
+        uint64_t to = std::min(limit - run.offset, run.length);
+        if (from >= to) continue;
+        const char *hit = (const char *)memchr(run.data + from, c, to - from);
+        if (hit) return run.offset + (hit - run.data);
+    }
+    return limit;
+}
+
+#endif
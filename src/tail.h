@@ -0,0 +1,158 @@
+#ifndef TAIL_H
+#define TAIL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "eventloop.h"
+
+const uint64_t TAIL_READ_BYTES = 64 << 20;  // bytes taken in per wakeup, so input keeps flowing
+
+/* Design of yano::Tail:
+    1. Follow mode keeps the buffer in step with a file another process is appending
+       to, as tail -F does. An inotify fd in the editor's event loop watches the file
+       and its directory, so nothing polls and an idle log costs nothing.
+    2. The file stays open and size() counts the bytes taken in so far. check() reports
+       the bytes past it, which yano::Yano reads straight onto the end of the buffer
+       (PieceTable::appendFrom()); what was taken in before is never read again.
+    3. A file that shrank was truncated in place, and a path that names another file
+       was rotated (or replaced by a save). check() reports either as TAIL_REPLACED and
+       the file is opened again from the start, dropping the old text and any unsaved
+       edits. A rotated file's name may stay missing for a while; the old file is
+       followed until a new one appears.
+    4. A followed file is never mapped: it is read into blocks when opened, like
+       everything appended later, so a writer that truncates it in place (copytruncate,
+       > file) cannot fault a reader on any thread. The old text stays readable until
+       inotify reports the truncation and the buffer is replaced.
+*/
+
+namespace yano
+{
+    enum TailChange { TAIL_NONE, TAIL_GREW, TAIL_REPLACED };
+
+    class Tail
+    {
+        public:
+            ~Tail() { stop(); }
+
+            // watch path, of which size bytes are in the buffer, calling changed on loop's
+            // thread whenever it may have changed. A missing path is watched for until it
+            // appears. False if it cannot be watched
+            bool start(EventLoop &loop, const std::string &path, uint64_t size, std::function<void()> changed);
+            void stop();
+            bool active() { return m_inotify != -1; }
+
+            // what happened to the file since the last call: with TAIL_GREW, the bytes
+            // [offset, offset + length) of fd() are new (at most TAIL_READ_BYTES of them)
+            TailChange check(uint64_t &offset, uint64_t &length);
+            int  fd() { return m_fd; }
+            // length bytes were taken in
+            void took(uint64_t length) { m_size += length; }
+            uint64_t size() { return m_size; }
+            // the file held more than has been taken in when last checked
+            bool behind() { return m_seen > m_size; }
+
+        private:
+            EventLoop              *m_loop = nullptr;
+            int                     m_inotify = -1;
+            int                     m_fd = -1;      // the file followed, even once renamed
+            int                     m_file_watch = -1;
+            int                     m_dir_watch = -1;
+            std::string             m_path;
+            std::string             m_name;         // m_path within its directory
+            uint64_t                m_size = 0;
+            uint64_t                m_seen = 0;
+            std::function<void()>   m_changed;
+
+            // read every queued event; true if any concerns the file
+            bool readEvents();
+    };
+};
+
+bool
+yano::Tail::start(EventLoop &loop, const std::string &path, uint64_t size, std::function<void()> changed)
+{
+    stop();
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify == -1) return false;
+
+    // the directory reports a file created or renamed onto the path
+    size_t slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : path.substr(0, std::max<size_t>(slash, 1));
+    m_name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    m_dir_watch = inotify_add_watch(m_inotify, dir.c_str(), IN_CREATE | IN_MOVED_TO);
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd != -1)
+        m_file_watch = inotify_add_watch(m_inotify, path.c_str(), IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    if (m_dir_watch == -1 || (m_fd != -1 && m_file_watch == -1)) {
+        stop();
+        return false;
+    }
+
+    m_loop = &loop;
+    m_path = path;
+    m_size = m_seen = size;
+    m_changed = changed;
+    bool added = loop.addFd(m_inotify, EPOLLIN, [this](uint32_t) {
+        if (readEvents()) m_changed();
+    });
+    if (!added) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void
+yano::Tail::stop()
+{
+    if (m_loop) m_loop->removeFd(m_inotify);
+    if (m_inotify != -1) close(m_inotify);
+    if (m_fd != -1) close(m_fd);
+    m_loop = nullptr;
+    m_inotify = m_fd = m_file_watch = m_dir_watch = -1;
+}
+
+bool
+yano::Tail::readEvents()
+{
+    alignas(struct inotify_event) char events[4096];
+    bool relevant = false;
+    for (;;) {
+        ssize_t n = read(m_inotify, events, sizeof(events));
+        if (n <= 0) break;
+        for (ssize_t i = 0; i < n; ) {
+            const struct inotify_event *event = (const struct inotify_event *)&events[i];
+            // the directory's other files are none of our business
+            if (event->wd != m_dir_watch || strcmp(event->name, m_name.c_str()) == 0) relevant = true;
+            if (event->mask & IN_Q_OVERFLOW) relevant = true;
+            i += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return relevant;
+}
+
+yano::TailChange
+yano::Tail::check(uint64_t &offset, uint64_t &length)
+{
+    struct stat named, held;
+    bool exists = stat(m_path.c_str(), &named) == 0;
+    if (m_fd == -1 || fstat(m_fd, &held) == -1) return exists ? TAIL_REPLACED : TAIL_NONE;
+    if (exists && (named.st_ino != held.st_ino || named.st_dev != held.st_dev)) return TAIL_REPLACED;
+    if ((uint64_t)held.st_size < m_size) return TAIL_REPLACED;
+
+    m_seen = held.st_size;
+    if (m_seen == m_size) return TAIL_NONE;
+    offset = m_size;
+    length = std::min(m_seen - m_size, TAIL_READ_BYTES);
+    return TAIL_GREW;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace yano
+{
+    // a fixed set of worker threads running submitted jobs in FIFO order
+    class ThreadPool
+    {
+        public:
+            // threads == 0 starts one worker per hardware thread
+            explicit ThreadPool(unsigned threads = 0);
+            // finishes the queued jobs, then joins the workers
+            ~ThreadPool();
+
+            void     submit(std::function<void()> job);
+            unsigned size() { return m_workers.size(); }
+
+        private:
+            std::vector<std::thread>           m_workers;
+            std::deque<std::function<void()>>  m_jobs;
+            std::mutex                         m_lock;
+            std::condition_variable            m_wake;
+            bool                               m_stopping = false;
+
+            void work();
+    };
+};
+
+yano::ThreadPool::ThreadPool(unsigned threads)
+{
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < threads; ++i)
+        m_workers.emplace_back(&ThreadPool::work, this);
+}
+
+yano::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &worker : m_workers)
+        worker.join();
+}
+
+void
+yano::ThreadPool::submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_jobs.push_back(std::move(job));
+    }
+    m_wake.notify_one();
+}
+
+void
+yano::ThreadPool::work()
+{
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_wake.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+            if (m_jobs.empty()) return;     // stopping, and nothing left to run
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        job();
+    }
+}
+
+#endif
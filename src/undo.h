@@ -0,0 +1,278 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "piecetable.h"
+
+const std::chrono::milliseconds UNDO_COALESCE_INTERVAL(1000); // typing pauses longer than this start a new step
+const size_t UNDO_MEMORY_LIMIT = 64 << 20;                     // bytes of log kept before old steps are dropped
+
+/* Design of yano::UndoLog:
+    1. Every edit is logged as an Op: where it happened and which pieces of the
+       PieceTable's buffers hold its text. Buffers are append-only, so erased text
+       stays where it was and an Op only needs (buffer, start, length) per piece.
+       Undoing or redoing an edit re-links those pieces, costing O(pieces log n)
+       however many bytes they cover.
+    2. The Ops and their pieces live in two flat arrays, so the log makes no
+       allocation per edit once the arrays have grown.
+    3. Edits that arrive less than UNDO_COALESCE_INTERVAL apart form one group, and
+       undo() reverses a whole group. Within a group, a contiguous insert or erase
+       extends the previous Op rather than adding one, so a burst of typing is a
+       single Op with a single piece. seal() ends the current group early.
+    4. Group boundaries are the log's checkpoints: when one is reached and the log is
+       over UNDO_MEMORY_LIMIT, the oldest groups are dropped until it is under 3/4 of
+       the limit. The text the log points at is part of the PieceTable either way.
+*/
+
+namespace yano
+{
+    class UndoLog
+    {
+        public:
+            typedef PieceTable::Span Span;
+
+            // call after text.insert(offset, ..., length)
+            void recordInsert(PieceTable &text, uint64_t offset, uint64_t length);
+            // call before text.erase(offset, length)
+            void recordErase(PieceTable &text, uint64_t offset, uint64_t length);
+            // the next edit starts a new group
+            void seal() { m_sealed = true; }
+            // forget everything, e.g. when the PieceTable is reopened
+            void clear();
+
+            // reverse/replay the last undone group. [first, last] is set to the offsets the
+            // group touched, as the text is afterwards, and cursor to where the cursor
+            // belongs; false if none is left
+            bool undo(PieceTable &text, uint64_t &first, uint64_t &last, uint64_t &cursor);
+            bool redo(PieceTable &text, uint64_t &first, uint64_t &last, uint64_t &cursor);
+
+            size_t memoryUsage() {
+                return m_ops.capacity() * sizeof(Op) + m_spans.capacity() * sizeof(Span);
+            }
+
+        private:
+            enum OpKind : uint8_t { INSERT, ERASE };
+
+            typedef struct Op {
+                uint64_t  offset;
+                uint64_t  length;
+                uint32_t  first_span;       // pieces are m_spans[first_span, first_span + span_count)
+                uint32_t  span_count;
+                OpKind    kind;
+                bool      group_start;
+            } Op;
+
+            std::vector<Op>    m_ops;
+            std::vector<Span>  m_spans;
+            size_t             m_applied = 0;     // m_ops[m_applied, end) are undone, ready to redo
+            bool               m_sealed = true;
+            std::chrono::steady_clock::time_point m_last_edit;
+
+            // drop undone ops and decide whether the next op continues the current group
+            bool begin();
+            void push(OpKind kind, uint64_t offset, uint64_t length, size_t first_span, bool group_start);
+            // drop the oldest groups while the log is over its budget
+            void trim();
+            // widen [first, last] by length bytes inserted (or erased) at offset, moving
+            // last along with the text after it
+            static void touched(bool inserted, uint64_t offset, uint64_t length, uint64_t &first, uint64_t &last);
+    };
+};
+
+void
+yano::UndoLog::recordInsert(PieceTable &text, uint64_t offset, uint64_t length)
+{
+    if (length == 0) return;
+    bool grouped = begin();
+
+    size_t first = m_spans.size();
+    text.pieces(offset, length, m_spans);
+
+    // typing at the end of the last insert extends it
+    Op *last = m_ops.empty() ? nullptr : &m_ops.back();
+    if (grouped && last && last->kind == INSERT && offset == last->offset + last->length) {
+        Span &tail = m_spans[first - 1];
+        size_t next = first;
+        if (tail.buffer == m_spans[first].buffer && tail.start + tail.length == m_spans[first].start) {
+            tail.length += m_spans[first].length;
+            ++next;
+        }
+        m_spans.erase(m_spans.begin() + first, m_spans.begin() + next);
+        last->length += length;
+        last->span_count = m_spans.size() - last->first_span;
+        return;
+    }
+    push(INSERT, offset, length, first, !grouped);
+}
+
+void
+yano::UndoLog::recordErase(PieceTable &text, uint64_t offset, uint64_t length)
+{
+    if (length == 0) return;
+    bool grouped = begin();
+
+    size_t first = m_spans.size();
+    text.pieces(offset, length, m_spans);
+
+    Op *last = m_ops.empty() ? nullptr : &m_ops.back();
+    if (grouped && last && last->kind == ERASE) {
+        if (offset + length == last->offset) {
+            // backspacing: the new pieces come before the ones already logged
+            Span &joint = m_spans.back();
+            Span &head = m_spans[last->first_span];
+            if (joint.buffer == head.buffer && joint.start + joint.length == head.start) {
+                head.start = joint.start;
+                head.length += joint.length;
+                m_spans.pop_back();
+            }
+            std::rotate(m_spans.begin() + last->first_span, m_spans.begin() + first, m_spans.end());
+            last->offset = offset;
+            last->length += length;
+            last->span_count = m_spans.size() - last->first_span;
+            return;
+        }
+        if (offset == last->offset) {
+            // deleting forward: the new pieces follow
+            Span &tail = m_spans[first - 1];
+            size_t next = first;
+            if (tail.buffer == m_spans[first].buffer && tail.start + tail.length == m_spans[first].start) {
+                tail.length += m_spans[first].length;
+                ++next;
+            }
+            m_spans.erase(m_spans.begin() + first, m_spans.begin() + next);
+            last->length += length;
+            last->span_count = m_spans.size() - last->first_span;
+            return;
+        }
+    }
+    push(ERASE, offset, length, first, !grouped);
+}
+
+void
+yano::UndoLog::clear()
+{
+    m_ops.clear();
+    m_spans.clear();
+    m_applied = 0;
+    m_sealed = true;
+}
+
+bool
+yano::UndoLog::undo(PieceTable &text, uint64_t &first, uint64_t &last, uint64_t &cursor)
+{
+    if (m_applied == 0) return false;
+    m_sealed = true;
+
+    first = UINT64_MAX;
+    last = 0;
+    do {
+        const Op &op = m_ops[--m_applied];
+        if (op.kind == INSERT) {
+            text.erase(op.offset, op.length);
+            cursor = op.offset;
+        } else {
+            text.insertPieces(op.offset, &m_spans[op.first_span], op.span_count);
+            cursor = op.offset + op.length;
+        }
+        touched(op.kind == ERASE, op.offset, op.length, first, last);
+    } while (!m_ops[m_applied].group_start);
+    return true;
+}
+
+bool
+yano::UndoLog::redo(PieceTable &text, uint64_t &first, uint64_t &last, uint64_t &cursor)
+{
+    if (m_applied == m_ops.size()) return false;
+    m_sealed = true;
+
+    first = UINT64_MAX;
+    last = 0;
+    do {
+        const Op &op = m_ops[m_applied++];
+        if (op.kind == INSERT) {
+            text.insertPieces(op.offset, &m_spans[op.first_span], op.span_count);
+            cursor = op.offset + op.length;
+        } else {
+            text.erase(op.offset, op.length);
+            cursor = op.offset;
+        }
+        touched(op.kind == INSERT, op.offset, op.length, first, last);
+    } while (m_applied < m_ops.size() && !m_ops[m_applied].group_start);
+    return true;
+}
+
+void
+yano::UndoLog::touched(bool inserted, uint64_t offset, uint64_t length, uint64_t &first, uint64_t &last)
+{
+    // text before offset stays where it was
+    first = std::min(first, offset);
+    if (inserted)
+        last = std::max((last >= offset) ? last + length : last, offset + length);
+    else
+        last = std::max((last > offset + length) ? last - length : std::min(last, offset), offset);
+}
+
+bool
+yano::UndoLog::begin()
+{
+    // a new edit makes the undone groups unreachable
+    if (m_applied < m_ops.size()) {
+        m_spans.resize(m_ops[m_applied].first_span);
+        m_ops.resize(m_applied);
+        m_sealed = true;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    bool grouped = !m_sealed && !m_ops.empty() && now - m_last_edit < UNDO_COALESCE_INTERVAL;
+    m_last_edit = now;
+    m_sealed = false;
+    if (!grouped) trim();
+    return grouped;
+}
+
+void
+yano::UndoLog::push(OpKind kind, uint64_t offset, uint64_t length, size_t first_span, bool group_start)
+{
+    Op op;
+    op.offset = offset;
+    op.length = length;
+    op.first_span = first_span;
+    op.span_count = m_spans.size() - first_span;
+    op.kind = kind;
+    op.group_start = group_start;
+    m_ops.push_back(op);
+    m_applied = m_ops.size();
+}
+
+void
+yano::UndoLog::trim()
+{
+    if (m_ops.empty() || m_ops.size() * sizeof(Op) + m_spans.size() * sizeof(Span) <= UNDO_MEMORY_LIMIT)
+        return;
+
+    // find the first group start that brings the log under 3/4 of the budget
+    size_t target = UNDO_MEMORY_LIMIT / 4 * 3;
+    size_t cut = 0;
+    for (size_t i = 1; i < m_ops.size(); ++i) {
+        if (!m_ops[i].group_start) continue;
+        cut = i;
+        size_t bytes = (m_ops.size() - i) * sizeof(Op) + (m_spans.size() - m_ops[i].first_span) * sizeof(Span);
+        if (bytes <= target) break;
+    }
+    if (cut == 0) return;      // one group holds everything; keep it
+
+    size_t span_cut = m_ops[cut].first_span;
+    m_ops.erase(m_ops.begin(), m_ops.begin() + cut);
+    m_spans.erase(m_spans.begin(), m_spans.begin() + span_cut);
+    for (Op &op : m_ops)
+        op.first_span -= span_cut;
+    m_applied -= cut;
+    m_ops.shrink_to_fit();
+    m_spans.shrink_to_fit();
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <cstdint>
+
+const uint32_t REPLACEMENT_CHARACTER = 0xfffd;
+
+namespace yano
+{
+    // decode one codepoint from s[0, length); returns the bytes consumed (at least 1).
+    // Malformed, overlong or truncated sequences decode as U+FFFD and consume one byte
+    inline int utf8Decode(const char *s, uint64_t length, uint32_t *codepoint) {
+        const uint8_t *p = (const uint8_t *)s;
+        uint32_t cp;
+        int n;
+        if (p[0] < 0x80)      { *codepoint = p[0]; return 1; }
+        else if (p[0] < 0xc2) { *codepoint = REPLACEMENT_CHARACTER; return 1; }
+        else if (p[0] < 0xe0) { cp = p[0] & 0x1f; n = 2; }
+        else if (p[0] < 0xf0) { cp = p[0] & 0x0f; n = 3; }
+        else if (p[0] < 0xf5) { cp = p[0] & 0x07; n = 4; }
+        else                  { *codepoint = REPLACEMENT_CHARACTER; return 1; }
+
+        if ((uint64_t)n > length) { *codepoint = REPLACEMENT_CHARACTER; return 1; }
+        for (int i = 1; i < n; ++i) {
+            if ((p[i] & 0xc0) != 0x80) { *codepoint = REPLACEMENT_CHARACTER; return 1; }
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        // reject overlong forms, surrogates and values past U+10FFFF
+        if ((n == 3 && cp < 0x800) || (n == 4 && (cp < 0x10000 || cp > 0x10ffff)) ||
+            (cp >= 0xd800 && cp <= 0xdfff)) {
+            *codepoint = REPLACEMENT_CHARACTER;
+            return 1;
+        }
+        *codepoint = cp;
+        return n;
+    }
+
+    // encode codepoint into out (at least 4 bytes); returns the number of bytes written
+    inline int utf8Encode(uint32_t codepoint, char *out) {
+        if (codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint <= 0xdfff))
+            codepoint = REPLACEMENT_CHARACTER;
+        if (codepoint < 0x80) {
+            out[0] = codepoint;
+            return 1;
+        } else if (codepoint < 0x800) {
+            out[0] = 0xc0 | (codepoint >> 6);
+            out[1] = 0x80 | (codepoint & 0x3f);
+            return 2;
+        } else if (codepoint < 0x10000) {
+            out[0] = 0xe0 | (codepoint >> 12);
+            out[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+            out[2] = 0x80 | (codepoint & 0x3f);
+            return 3;
+        }
+        out[0] = 0xf0 | (codepoint >> 18);
+        out[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+        out[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+        out[3] = 0x80 | (codepoint & 0x3f);
+        return 4;
+    }
+
+    // true for bytes that continue a multi-byte sequence
+    inline bool utf8Continuation(char c) {
+        return ((uint8_t)c & 0xc0) == 0x80;
+    }
+
+    // number of codepoints in s[0, length), counted the same way utf8Decode splits them
+    inline uint64_t utf8Length(const char *s, uint64_t length) {
+        uint64_t count = 0;
+        uint32_t cp;
+        for (uint64_t i = 0; i < length; ++count) {
+            if ((uint8_t)s[i] < 0x80) { ++i; continue; }
+            i += utf8Decode(s + i, length - i, &cp);
+        }
+        return count;
+    }
+};
+
+#endif
@@ -4,29 +4,62 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <xcb/xcb.h>
-#include <xcb/xcb_image.h>
+#include <xcb/render.h>
+#include <xcb/shm.h>
 #include <X11/Xlib.h>
 
+#include "backend.h"
+#include "log.h"
+
 const int32_t DEFAULT_WIDTH       = 800;
 const int32_t DEFAULT_HEIGHT      = 600;
 const char*   DEFAULT_WINDOW_NAME = "Generic Window";
 const int16_t DEFAULT_DISPLAY_NUM = 0;
 const uint8_t IMAGE_DEPTH         = 24; // "True Color (8-bit)"
 const uint8_t IMAGE_STORAGE_DEPTH = 32;
+const uint16_t TILE_WIDTH         = 256;
+const uint16_t TILE_HEIGHT        = 64; // a tile of pixels is 64KB, within any server's request limit
+const uint32_t GLYPHS_PER_ELT     = 254; // glyphs one CompositeGlyphs element can hold
+const size_t   MAX_COPY_RECTS     = 16;  // past this, pixmap-to-window copies take one bounding box
 
 /* Design of pw::Window:
     1. Instantiate with Window(width, height, title, display_num);
-    2. Open a while(!shouldClose()) loop
-    3. Add main logic into the loop, along with a pollEvents() call
-    4. Two-part drawing procedure:
+    2. Wait for fd() to become readable (e.g. in an epoll loop) until shouldClose()
+    3. Collect every pending key with pollEvents(), then run main logic on the batch
+    4. Three-part drawing procedure:
         a. Directly draw to drawable
-        b. Refresh on-screen image
+        b. Mark the touched area with damage(x, y, width, height)
+        c. Call present() to upload only the damaged areas; nothing is sent when idle
+    5. scroll() moves pixels that are already drawn, in drawable and in the server's
+       pixmap alike, so after a scroll only the uncovered strip needs drawing and sending.
+    6. Damage is kept per tile: drawable is cut into TILE_WIDTH x TILE_HEIGHT tiles, each
+       holding the bounding box of its own damage, plus a list of the dirty ones. present()
+       sends each dirty tile's box, joining boxes that continue one another along a row, so
+       a changed line goes out as one strip and a full-screen frame as a few tiles at a
+       time instead of one request the size of the screen. Requests larger than the
+       server's limit are split by rows; xcb turns on BIG-REQUESTS when the server has it.
+    7. drawable and the pixmap are allocated for the whole screen, so a window manager
+       resize (ConfigureNotify) only changes the size in use and which tiles count.
+       Growing past the screen reallocates both once.
+    8. Text can instead be drawn by the server (see backend.h): each glyph is uploaded once
+       into an XRender GlyphSet as 8-bit coverage, and a run of cells becomes a fill plus
+       one CompositeGlyphs request of glyph ids, a few bytes per cell instead of every
+       pixel. It is picked at startup when pixels would have to cross the socket, i.e.
+       without MIT-SHM (a remote or SSH-forwarded display), and the server has RENDER
+       0.10 or later; $YANO_RENDER set to "glyphs" or "pixels" overrides the choice.
 */
 
 namespace pw
 {
-    class Window 
+    class Window : public Backend
     {
         public:
             // empty parameters: -1, -1, NULL, -1
@@ -37,61 +70,142 @@ namespace pw
             ~Window();
 
             // event functions
-            bool shouldClose();
-            void pollEvents(xcb_keycode_t *keycode,
-                            uint32_t      *modifiers);
+            bool shouldClose() override;
+            void pollEvents(std::vector<KeyEvent> &keys) override;
+            // the X connection's socket
+            int  fd() override { return xcb_get_file_descriptor(m_connection); }
+
+            void damage(int16_t  x,
+                        int16_t  y,
+                        uint16_t width,
+                        uint16_t height) override;
+            // upload the merged damaged areas and copy them onto the window
+            PresentTiming present() override;
+            // also moves the pixels already on the server's pixmap
+            void scroll(int16_t  y,
+                        uint16_t height,
+                        int16_t  dy) override;
+            void resize(uint16_t width, uint16_t height) override;
 
+            bool hasGlyphs() override { return m_render; }
+            void resetGlyphs(uint16_t width, uint16_t height) override;
+            void addGlyph(uint32_t id, const uint8_t *coverage) override;
+            void drawGlyphs(int16_t         x,
+                            int16_t         y,
+                            const uint32_t *ids,
+                            uint32_t        count,
+                            uint32_t        fg,
+                            uint32_t        bg) override;
+            void fillGlyphArea(int16_t  x,
+                               int16_t  y,
+                               uint16_t width,
+                               uint16_t height,
+                               uint32_t color) override;
+
+            // copy an already-uploaded area of the backing pixmap onto the window
             void display(int16_t x,
                          int16_t y,
-                         uint16_t rows,
-                         uint16_t cols);
+                         uint16_t width,
+                         uint16_t height);
 
-            uint8_t            *drawable;      // format [width][height][4]
-            uint16_t            window_width;
-            uint16_t            window_height;
         private:
             // XCB-specific members
             xcb_connection_t          *m_connection;
             const xcb_setup_t         *m_setup;          // setup info
             xcb_window_t               m_xid;            // window id
             xcb_gcontext_t             m_gcid;           // graphics context id
-            xcb_pixmap_t               m_pxid;           // pixmap id
+            xcb_pixmap_t               m_pxid;           // pixmap id, stride x m_capacity_rows
+            uint8_t                    m_depth;          // of the pixmap
             xcb_format_t              *m_pxfmt;          // pixmap format
             xcb_colormap_t             m_colormap;
-            xcb_image_t               *m_image;
+            uint32_t                   m_max_request_bytes;
+
+            uint16_t                   m_capacity_rows;  // rows allocated in drawable
+
+            // damage tracking; written by the drawing thread, drained by present()
+            std::mutex                    m_damage_lock;
+            uint32_t                      m_tiles_x;     // tiles per row of the allocation
+            std::vector<xcb_rectangle_t>  m_tile_damage; // per tile; width 0 when clean
+            std::vector<uint32_t>         m_dirty;       // indices of tiles with damage
+            std::vector<xcb_rectangle_t>  m_pending;     // present()'s private copy
+            std::vector<xcb_rectangle_t>  m_on_pixmap;   // scrolled or drawn on the pixmap, not yet shown
+            std::vector<uint8_t>          m_scratch;     // packs sub-image and glyph rows for upload
+
+            // MIT-SHM framebuffer; when attached, drawable lives in the segment and the
+            // server reads pixels straight out of it instead of through the socket
+            bool                       m_shm = false;
+            xcb_shm_seg_t              m_shm_seg;
+            int                        m_shm_id = -1;
+
+            // XRender text, when hasGlyphs()
+            typedef struct GlyphElt {    // header of one element of CompositeGlyphs' list
+                uint8_t   count;
+                uint8_t   pad[3];
+                int16_t   dx;               // from the end of the previous element
+                int16_t   dy;
+            } GlyphElt;
+
+            bool                       m_render = false;
+            xcb_render_pictformat_t    m_a8_format = 0;  // glyph coverage
+            xcb_render_pictformat_t    m_rgb_format = 0; // the pixmap's
+            xcb_render_picture_t       m_picture = 0;    // on m_pxid
+            xcb_render_glyphset_t      m_glyph_set = 0;
+            uint16_t                   m_glyph_width = 0;
+            uint16_t                   m_glyph_height = 0;
+            uint32_t                   m_max_glyph = 0;  // largest id added; picks 8, 16 or 32-bit ids
+            std::vector<std::pair<uint32_t, xcb_render_picture_t>>  m_solids;  // fill source per color
+            std::vector<uint8_t>       m_glyph_cmds;
 
             // Window-specific members
-            bool                m_should_close = false;
+            std::atomic<bool>   m_should_close{false};  // read by the render thread too
             const char         *m_window_name;
 
-            // drawable setup function
-            // for whatever reason, will not draw unless width*height*4 < 2^24
+            // drawable setup function; also sizes the tile grid
             void format_drawable(uint16_t width, uint16_t height) {
-                drawable = (uint8_t *)malloc(width * height * (IMAGE_STORAGE_DEPTH >> 3));
-                m_image = xcb_image_create(width,
-                                           height,
-                                           XCB_IMAGE_FORMAT_Z_PIXMAP,
-                                           m_pxfmt->scanline_pad,
-                                           m_pxfmt->depth,
-                                           m_pxfmt->bits_per_pixel,
-                                           0,
-                                           XCB_IMAGE_ORDER_MSB_FIRST,
-                                           XCB_IMAGE_ORDER_LSB_FIRST,
-                                           drawable,
-                                           width*height*(IMAGE_STORAGE_DEPTH >> 3),
-                                           drawable);
+                size_t bytes = (size_t)width * height * (IMAGE_STORAGE_DEPTH >> 3);
+                m_shm = attach_shm(bytes);
+                if (!m_shm)
+                    drawable = (uint8_t *)malloc(bytes);
+                if (drawable == NULL) {
+                    printf("Error: cannot allocate a %ux%u framebuffer.\n", width, height);
+                    exit(1);
+                }
+                stride = width;
+                m_capacity_rows = height;
+                m_tiles_x = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+                m_tile_damage.assign(m_tiles_x * ((height + TILE_HEIGHT - 1) / TILE_HEIGHT),
+                                     { 0, 0, 0, 0 });
+                m_dirty.clear();
+                YANO_LOG("Framebuffer transport: %s, %ux%u\n", m_shm ? "MIT-SHM" : "socket", width, height);
+            }
+            void free_drawable();
+            // try to place drawable in a shared memory segment attached to the server
+            bool attach_shm(size_t bytes);
+            // decide on XRender text and set it up; false keeps text in drawable
+            bool attach_render();
+            // a picture of solid color, for compositing glyphs in it
+            xcb_render_picture_t solid(uint32_t color);
+            // a BGRX pixel as XRender's 16 bits per channel
+            static xcb_render_color_t render_color(uint32_t color) {
+                return { (uint16_t)(((color >> 16) & 0xff) * 0x101),
+                         (uint16_t)(((color >> 8) & 0xff) * 0x101),
+                         (uint16_t)((color & 0xff) * 0x101), 0xffff };
             }
+            // add [x0, x1) x [y0, y1) to the tiles it covers; m_damage_lock must be held
+            void damage_tiles(int32_t x0, int32_t y0, int32_t x1, int32_t y1);
+            // send one rectangle of drawable to the backing pixmap, split to fit the request limit
+            void upload(const xcb_rectangle_t &rect);
             // format setup function
             xcb_format_t *find_px_format(const xcb_setup_t *setup) {
                 xcb_format_t *px_it = xcb_setup_pixmap_formats(setup);
                 xcb_format_t *it_end = px_it + xcb_setup_pixmap_formats_length(setup);
                 for ( ; px_it != it_end; ++px_it) {
-                    printf("Available pixmap format: scanline_pad: %d, depth: %d, bpp: %d\n", 
+                    YANO_LOG("Available pixmap format: scanline_pad: %d, depth: %d, bpp: %d\n",
                             px_it->scanline_pad, px_it->depth, px_it->bits_per_pixel);
                     if ((px_it->depth == IMAGE_DEPTH) && (px_it->bits_per_pixel == IMAGE_STORAGE_DEPTH))
                         return px_it;
                 }
-                printf("No suitable pixmap format found. Ending.\n");
+                printf("Error: no suitable pixmap format found.\n");
                 exit(-1);
             }
     };
@@ -108,7 +222,7 @@ pw::Window::Window(int16_t     windowWidth,
     m_window_name = (windowName == NULL) ? DEFAULT_WINDOW_NAME : windowName;
     if (displayNum == -1) displayNum = DEFAULT_DISPLAY_NUM;
 
-    printf("Window width, height: (%d, %d)", window_width, window_height);
+    YANO_LOG("Window width, height: (%d, %d)\n", window_width, window_height);
 
     m_connection = xcb_connect(
         NULL,   // const char*, display name; can be NULL (defaults to $DISPLAY)
@@ -118,6 +232,8 @@ pw::Window::Window(int16_t     windowWidth,
         printf("Error: Cannot open window.\n");
         exit(1);
     }
+    // asks for BIG-REQUESTS now; the answer is collected below without a second round trip
+    xcb_prefetch_maximum_request_length(m_connection);
 
     // check basic info about connection
     m_setup = xcb_get_setup(m_connection);
@@ -129,13 +245,13 @@ pw::Window::Window(int16_t     windowWidth,
 
     // display preliminary info
     xcb_screen_t *display = display_it.data;
-    printf("\n");
-    printf("Max display resolution: (%d, %d)\n", display->width_in_pixels, display->height_in_pixels);
+    YANO_LOG("Max display resolution: (%d, %d)\n", display->width_in_pixels, display->height_in_pixels);
 
     // create the window
     m_xid = xcb_generate_id(m_connection);
     uint32_t mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
-    uint32_t values[2] = { display->black_pixel, XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_EXPOSURE };
+    uint32_t values[2] = { display->black_pixel, XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_EXPOSURE |
+                                                 XCB_EVENT_MASK_STRUCTURE_NOTIFY };
     xcb_create_window(m_connection,
                       XCB_COPY_FROM_PARENT, // window depth
                       m_xid,
@@ -154,14 +270,19 @@ pw::Window::Window(int16_t     windowWidth,
     // allocate color map
     m_colormap = display->default_colormap;
 
+    // room for the window to grow to the whole screen without reallocating
+    uint16_t capacity_width = std::max(window_width, display->width_in_pixels);
+    uint16_t capacity_height = std::max(window_height, display->height_in_pixels);
+
     // generate pixmap
+    m_depth = display->root_depth;
     m_pxid = xcb_generate_id(m_connection);
     xcb_create_pixmap(m_connection,
-                      display->root_depth,
+                      m_depth,
                       m_pxid,
                       m_xid,
-                      window_width,
-                      window_height);
+                      capacity_width,
+                      capacity_height);
 
     // set up graphics context
     m_gcid = xcb_generate_id(m_connection);
@@ -176,9 +297,16 @@ pw::Window::Window(int16_t     windowWidth,
     // generate framebuffer
     m_pxfmt = find_px_format(m_setup);
 
+    // largest request the server accepts (in 4-byte units), with BIG-REQUESTS if it has
+    // them; uploads are split to fit
+    m_max_request_bytes = xcb_get_maximum_request_length(m_connection) * 4;
+    YANO_LOG("Maximum request length: %u bytes\n", m_max_request_bytes);
+
     // create the drawable array attached to the window
-    format_drawable(windowWidth, windowHeight);
-    //format_drawable(display->width_in_pixels, display->height_in_pixels);
+    format_drawable(capacity_width, capacity_height);
+    configure(window_width, window_height);
+    m_render = attach_render();
+    YANO_LOG("Text: %s\n", m_render ? "XRender glyphs" : "pixels");
 
     // change name of window
     xcb_change_property(m_connection,
@@ -202,12 +330,17 @@ pw::Window::Window(int16_t     windowWidth,
 
 pw::Window::~Window()
 {
-    free(m_image);
-    free(drawable);
+    if (m_render) {
+        if (m_glyph_set) xcb_render_free_glyph_set(m_connection, m_glyph_set);
+        for (const auto &entry : m_solids)
+            xcb_render_free_picture(m_connection, entry.second);
+        xcb_render_free_picture(m_connection, m_picture);
+    }
+    free_drawable();
     xcb_free_pixmap(m_connection, m_pxid);
     xcb_free_colormap(m_connection, m_colormap);
     xcb_disconnect(m_connection);
-    printf("Destroyed window.\n");
+    YANO_LOG("Destroyed window.\n");
 }
 
 bool 
@@ -216,36 +349,308 @@ pw::Window::shouldClose()
     return m_should_close;
 }
 
-void 
-pw::Window::pollEvents(xcb_keycode_t *keycode, uint32_t *modifiers)
+void
+pw::Window::pollEvents(std::vector<KeyEvent> &keys)
 {
-    xcb_generic_event_t *event = xcb_poll_for_event(m_connection);
-    if (event == NULL) return;
-    switch (event->response_type & ~0x80) {
-        case XCB_EXPOSE: {
-            xcb_expose_event_t *expose = (xcb_expose_event_t *) event;
-            window_width = expose->x + expose->width;
-            window_height = expose->y + expose->height;
-            display(expose->x, expose->y, expose->width, expose->height);
+    xcb_generic_event_t *event;
+    while ((event = xcb_poll_for_event(m_connection)) != NULL) {
+        switch (event->response_type & ~0x80) {
+            case XCB_EXPOSE: {
+                // the pixmap already holds everything uploaded so far; no pixels need resending
+                xcb_expose_event_t *expose = (xcb_expose_event_t *) event;
+                display(expose->x, expose->y, expose->width, expose->height);
+                break;
+            }
+            case XCB_CONFIGURE_NOTIFY: {
+                // the drawing thread picks the new size up through configuredSize()
+                xcb_configure_notify_event_t *configure_event = (xcb_configure_notify_event_t *)event;
+                if (configure_event->window == m_xid)
+                    configure(configure_event->width, configure_event->height);
+                break;
+            }
+            case XCB_KEY_PRESS: {
+                xcb_key_press_event_t *kp = (xcb_key_press_event_t *)event;
+                YANO_LOG("Key pressed: %u, state: %u\n", kp->detail, kp->state);
+                if (kp->detail == 9) {
+                    YANO_LOG("Closing window.\n");
+                    m_should_close = true;
+                } else {
+                    keys.push_back({ kp->detail, kp->state });
+                }
+                break;
+            }
         }
-        case XCB_KEY_PRESS: {
-            xcb_key_press_event_t *kp = (xcb_key_press_event_t *)event;
-            printf("%u\n", kp->state);
-            printf("Key pressed: %u\n", kp->detail);
-            if (kp->detail == 9) {
-                printf("Closing window.\n");
-                m_should_close = true;
+        free(event);
+    }
+    takeInjected(keys);
+
+    // a dead connection keeps the socket readable forever; stop instead of spinning
+    if (xcb_connection_has_error(m_connection)) m_should_close = true;
+}
+
+void
+pw::Window::damage(int16_t  x,
+                   int16_t  y,
+                   uint16_t width,
+                   uint16_t height)
+{
+    // clip to the drawable so uploads never read past it
+    int32_t x0 = std::max<int32_t>(x, 0);
+    int32_t y0 = std::max<int32_t>(y, 0);
+    int32_t x1 = std::min<int32_t>(x + width, window_width);
+    int32_t y1 = std::min<int32_t>(y + height, window_height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    std::lock_guard<std::mutex> lock(m_damage_lock);
+    damage_tiles(x0, y0, x1, y1);
+}
+
+void
+pw::Window::damage_tiles(int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    for (int32_t ty = y0 / TILE_HEIGHT; ty * TILE_HEIGHT < y1; ++ty) {
+        int32_t top = std::max<int32_t>(y0, ty * TILE_HEIGHT);
+        int32_t bottom = std::min<int32_t>(y1, (ty + 1) * TILE_HEIGHT);
+        for (int32_t tx = x0 / TILE_WIDTH; tx * TILE_WIDTH < x1; ++tx) {
+            int32_t left = std::max<int32_t>(x0, tx * TILE_WIDTH);
+            int32_t right = std::min<int32_t>(x1, (tx + 1) * TILE_WIDTH);
+            uint32_t index = ty * m_tiles_x + tx;
+            xcb_rectangle_t &tile = m_tile_damage[index];
+            if (tile.width == 0) {
+                m_dirty.push_back(index);
             } else {
-                *keycode = kp->detail;
-                for (int i = 0; kp->state != 0; kp->state >>= 1, ++i) {
-                    modifiers[i] = kp->state & 1;
-                }
+                left = std::min<int32_t>(left, tile.x);
+                top = std::min<int32_t>(top, tile.y);
+                right = std::max<int32_t>(right, tile.x + tile.width);
+                bottom = std::max<int32_t>(bottom, tile.y + tile.height);
             }
-            break;
+            tile = { (int16_t)left, (int16_t)top, (uint16_t)(right - left), (uint16_t)(bottom - top) };
         }
     }
-    //xcb_flush(m_connection);
-    free(event);
+}
+
+pw::PresentTiming
+pw::Window::present()
+{
+    PresentTiming timing = { 0, 0 };
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(m_damage_lock);
+        if (m_dirty.empty() && m_on_pixmap.empty()) return timing;
+
+        // row-major order puts neighbouring tiles next to each other; a box that picks up
+        // where the previous one stopped, at the same height, extends it
+        std::sort(m_dirty.begin(), m_dirty.end());
+        m_pending.clear();
+        for (uint32_t index : m_dirty) {
+            xcb_rectangle_t &tile = m_tile_damage[index];
+            xcb_rectangle_t *last = m_pending.empty() ? NULL : &m_pending.back();
+            if (last && last->y == tile.y && last->height == tile.height &&
+                last->x + last->width == tile.x)
+                last->width += tile.width;
+            else
+                m_pending.push_back(tile);
+            tile.width = 0;
+        }
+        m_dirty.clear();
+    }
+
+    for (const xcb_rectangle_t &rect : m_pending) {
+        if (m_shm) {
+            // the server copies straight out of the segment; nothing is packed or sent
+            xcb_shm_put_image(m_connection, m_pxid, m_gcid,
+                              stride, m_capacity_rows,
+                              rect.x, rect.y, rect.width, rect.height,
+                              rect.x, rect.y,
+                              m_pxfmt->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                              0,                // no completion event
+                              m_shm_seg, 0);
+        } else {
+            upload(rect);
+        }
+        xcb_copy_area(m_connection, m_pxid, m_xid, m_gcid,
+                      rect.x, rect.y, rect.x, rect.y, rect.width, rect.height);
+    }
+    // scrolled bands and server-drawn text are already right on the pixmap; the window
+    // only needs a copy, which sends no pixels, so many of them become one larger copy
+    if (m_on_pixmap.size() > MAX_COPY_RECTS) {
+        int32_t x0 = window_width, y0 = window_height, x1 = 0, y1 = 0;
+        for (const xcb_rectangle_t &r : m_on_pixmap) {
+            x0 = std::min<int32_t>(x0, r.x);
+            y0 = std::min<int32_t>(y0, r.y);
+            x1 = std::max<int32_t>(x1, r.x + r.width);
+            y1 = std::max<int32_t>(y1, r.y + r.height);
+        }
+        m_on_pixmap.assign(1, { (int16_t)x0, (int16_t)y0, (uint16_t)(x1 - x0), (uint16_t)(y1 - y0) });
+    }
+    for (const xcb_rectangle_t &rect : m_on_pixmap)
+        xcb_copy_area(m_connection, m_pxid, m_xid, m_gcid,
+                      rect.x, rect.y, rect.x, rect.y, rect.width, rect.height);
+    m_on_pixmap.clear();
+    auto uploaded = std::chrono::steady_clock::now();
+    xcb_flush(m_connection);    // image doesn't display unless this is written in
+
+    timing.upload_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(uploaded - start).count();
+    timing.flush_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - uploaded).count();
+    return timing;
+}
+
+void
+pw::Window::scroll(int16_t  y,
+                   uint16_t height,
+                   int16_t  dy)
+{
+    int32_t y0 = std::max<int32_t>(y, 0);
+    int32_t y1 = std::min<int32_t>(y + height, window_height);
+    int32_t moved = (y1 - y0) - std::abs(dy);
+    if (moved <= 0) return;     // nothing survives; the caller redraws the whole band
+
+    int32_t from = (dy < 0) ? y0 - dy : y0;
+    int32_t to = from + dy;
+    size_t row_bytes = (size_t)stride * (IMAGE_STORAGE_DEPTH >> 3);
+    if (!m_render)      // server-drawn text never touches drawable
+        memmove(drawable + to * row_bytes, drawable + from * row_bytes, moved * row_bytes);
+
+    // the pixmap holds everything presented so far, so it can be moved the same way
+    // server-side; damage not yet uploaded moves along with the pixels it describes
+    xcb_copy_area(m_connection, m_pxid, m_pxid, m_gcid, 0, from, 0, to, window_width, moved);
+
+    std::lock_guard<std::mutex> lock(m_damage_lock);
+    std::vector<xcb_rectangle_t> shifted;
+    for (uint32_t index : m_dirty) {
+        // the unshifted box stays: any part of it outside the band is still stale
+        const xcb_rectangle_t r = m_tile_damage[index];
+        int32_t r0 = std::max<int32_t>(r.y + dy, y0);
+        int32_t r1 = std::min<int32_t>(r.y + r.height + dy, y1);
+        if (r0 < r1 && r.y < y1 && r.y + r.height > y0)
+            shifted.push_back({ r.x, (int16_t)r0, r.width, (uint16_t)(r1 - r0) });
+    }
+    for (const xcb_rectangle_t &r : shifted)
+        damage_tiles(r.x, r.y, r.x + r.width, r.y + r.height);
+    m_on_pixmap.push_back({ 0, (int16_t)y0, window_width, (uint16_t)(y1 - y0) });
+}
+
+void
+pw::Window::resize(uint16_t width, uint16_t height)
+{
+    std::lock_guard<std::mutex> lock(m_damage_lock);
+    if (width > stride || height > m_capacity_rows) {
+        uint16_t capacity_width = std::max<uint32_t>(width, stride);
+        uint16_t capacity_height = std::max(height, m_capacity_rows);
+        free_drawable();
+        format_drawable(capacity_width, capacity_height);
+        xcb_free_pixmap(m_connection, m_pxid);
+        m_pxid = xcb_generate_id(m_connection);
+        xcb_create_pixmap(m_connection, m_depth, m_pxid, m_xid, capacity_width, capacity_height);
+        if (m_render) {
+            xcb_render_free_picture(m_connection, m_picture);
+            m_picture = xcb_generate_id(m_connection);
+            xcb_render_create_picture(m_connection, m_picture, m_pxid, m_rgb_format, 0, NULL);
+        }
+    }
+    window_width = width;
+    window_height = height;
+
+    // the caller redraws everything at the new size
+    for (uint32_t index : m_dirty)
+        m_tile_damage[index].width = 0;
+    m_dirty.clear();
+    m_on_pixmap.clear();
+}
+
+void
+pw::Window::resetGlyphs(uint16_t width, uint16_t height)
+{
+    if (!m_render) return;
+    if (m_glyph_set) xcb_render_free_glyph_set(m_connection, m_glyph_set);
+    m_glyph_set = xcb_generate_id(m_connection);
+    xcb_render_create_glyph_set(m_connection, m_glyph_set, m_a8_format);
+    m_glyph_width = width;
+    m_glyph_height = height;
+    m_max_glyph = 0;
+}
+
+void
+pw::Window::addGlyph(uint32_t id, const uint8_t *coverage)
+{
+    if (!m_render) return;
+    // rows of an A8 image are padded to 4 bytes
+    uint32_t row_bytes = (m_glyph_width + 3) & ~3u;
+    m_scratch.assign(row_bytes * m_glyph_height, 0);
+    for (uint32_t y = 0; y < m_glyph_height; ++y)
+        memcpy(&m_scratch[y * row_bytes], coverage + y * m_glyph_width, m_glyph_width);
+
+    // drawn from its top left corner, advancing one cell
+    xcb_render_glyphinfo_t info = { m_glyph_width, m_glyph_height, 0, 0, (int16_t)m_glyph_width, 0 };
+    xcb_render_add_glyphs(m_connection, m_glyph_set, 1, &id, &info, m_scratch.size(), m_scratch.data());
+    m_max_glyph = std::max(m_max_glyph, id);
+}
+
+void
+pw::Window::drawGlyphs(int16_t         x,
+                       int16_t         y,
+                       const uint32_t *ids,
+                       uint32_t        count,
+                       uint32_t        fg,
+                       uint32_t        bg)
+{
+    if (!m_render || count == 0) return;
+    fillGlyphArea(x, y, count * m_glyph_width, m_glyph_height, bg);
+
+    // the first element moves to (x, y); each later one carries on where it left off.
+    // Ids take the fewest bytes that fit the largest one uploaded
+    uint32_t id_bytes = (m_max_glyph < 256) ? 1 : (m_max_glyph < 65536) ? 2 : 4;
+    m_glyph_cmds.clear();
+    for (uint32_t i = 0; i < count; i += GLYPHS_PER_ELT) {
+        uint32_t n = std::min(GLYPHS_PER_ELT, count - i);
+        GlyphElt elt = { (uint8_t)n, { 0, 0, 0 }, (int16_t)((i == 0) ? x : 0), (int16_t)((i == 0) ? y : 0) };
+        size_t at = m_glyph_cmds.size();
+        m_glyph_cmds.resize(at + sizeof(elt) + ((n * id_bytes + 3) & ~3u), 0);
+        memcpy(&m_glyph_cmds[at], &elt, sizeof(elt));
+        uint8_t *dst = &m_glyph_cmds[at + sizeof(elt)];
+        for (uint32_t g = 0; g < n; ++g) {
+            uint32_t id = ids[i + g];
+            if (id_bytes == 1) dst[g] = id;
+            else if (id_bytes == 2) { uint16_t id16 = id; memcpy(dst + 2 * g, &id16, 2); }
+            else memcpy(dst + 4 * g, &id, 4);
+        }
+    }
+
+    xcb_render_picture_t src = solid(fg);
+    if (id_bytes == 1)
+        xcb_render_composite_glyphs_8(m_connection, XCB_RENDER_PICT_OP_OVER, src, m_picture, 0,
+                                      m_glyph_set, 0, 0, m_glyph_cmds.size(), m_glyph_cmds.data());
+    else if (id_bytes == 2)
+        xcb_render_composite_glyphs_16(m_connection, XCB_RENDER_PICT_OP_OVER, src, m_picture, 0,
+                                       m_glyph_set, 0, 0, m_glyph_cmds.size(), m_glyph_cmds.data());
+    else
+        xcb_render_composite_glyphs_32(m_connection, XCB_RENDER_PICT_OP_OVER, src, m_picture, 0,
+                                       m_glyph_set, 0, 0, m_glyph_cmds.size(), m_glyph_cmds.data());
+}
+
+void
+pw::Window::fillGlyphArea(int16_t  x,
+                          int16_t  y,
+                          uint16_t width,
+                          uint16_t height,
+                          uint32_t color)
+{
+    if (!m_render) return;
+    xcb_rectangle_t rect = { x, y, width, height };
+    xcb_render_fill_rectangles(m_connection, XCB_RENDER_PICT_OP_SRC, m_picture, render_color(color), 1, &rect);
+    m_on_pixmap.push_back(rect);
+}
+
+xcb_render_picture_t
+pw::Window::solid(uint32_t color)
+{
+    for (const auto &entry : m_solids)
+        if (entry.first == color) return entry.second;
+    xcb_render_picture_t picture = xcb_generate_id(m_connection);
+    xcb_render_create_solid_fill(m_connection, picture, render_color(color));
+    m_solids.push_back({ color, picture });
+    return picture;
 }
 
 void
@@ -254,9 +659,141 @@ pw::Window::display(int16_t x,
                     uint16_t width,
                     uint16_t height)
 {
-    xcb_image_put(m_connection, m_pxid, m_gcid, m_image, 0, 0, 0);
+    std::lock_guard<std::mutex> lock(m_damage_lock);    // resize() may replace the pixmap
     xcb_copy_area(m_connection, m_pxid, m_xid, m_gcid, x, y, x, y, width, height);
-    xcb_flush(m_connection);    // image doesn't display unless this is written in
+    xcb_flush(m_connection);
+}
+
+void
+pw::Window::free_drawable()
+{
+    if (m_shm) {
+        xcb_shm_detach(m_connection, m_shm_seg);
+        shmdt(drawable);
+    } else {
+        free(drawable);
+    }
+    drawable = nullptr;
+}
+
+bool
+pw::Window::attach_shm(size_t bytes)
+{
+    // a remote server would attach whatever segment happens to share our id on its host
+    const char *display_name = getenv("DISPLAY");
+    if (display_name == NULL ||
+        !(display_name[0] == ':' || display_name[0] == '/' || strncmp(display_name, "unix:", 5) == 0))
+        return false;
+
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(m_connection, &xcb_shm_id);
+    if (ext == NULL || !ext->present) return false;
+
+    xcb_shm_query_version_reply_t *version =
+        xcb_shm_query_version_reply(m_connection, xcb_shm_query_version(m_connection), NULL);
+    if (version == NULL) return false;
+    free(version);
+
+    m_shm_id = shmget(IPC_PRIVATE, bytes, IPC_CREAT | 0600);
+    if (m_shm_id == -1) return false;
+
+    void *addr = shmat(m_shm_id, NULL, 0);
+    if (addr == (void *)-1) {
+        shmctl(m_shm_id, IPC_RMID, NULL);
+        return false;
+    }
+
+    m_shm_seg = xcb_generate_id(m_connection);
+    xcb_generic_error_t *error =
+        xcb_request_check(m_connection, xcb_shm_attach_checked(m_connection, m_shm_seg, m_shm_id, 1));
+
+    // once both sides are attached the id can go; the segment lives until both detach
+    shmctl(m_shm_id, IPC_RMID, NULL);
+
+    if (error != NULL) {
+        free(error);
+        shmdt(addr);
+        return false;
+    }
+
+    drawable = (uint8_t *)addr;
+    return true;
+}
+
+bool
+pw::Window::attach_render()
+{
+    const char *mode = getenv("YANO_RENDER");
+    if (mode ? strcmp(mode, "glyphs") != 0 : m_shm) return false;
+
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(m_connection, &xcb_render_id);
+    if (ext == NULL || !ext->present) return false;
+
+    // solid fill pictures arrived in 0.10
+    xcb_render_query_version_reply_t *version =
+        xcb_render_query_version_reply(m_connection, xcb_render_query_version(m_connection, 0, 11), NULL);
+    if (version == NULL) return false;
+    bool recent = version->major_version > 0 || version->minor_version >= 10;
+    free(version);
+    if (!recent) return false;
+
+    xcb_render_query_pict_formats_reply_t *formats =
+        xcb_render_query_pict_formats_reply(m_connection, xcb_render_query_pict_formats(m_connection), NULL);
+    if (formats == NULL) return false;
+    xcb_render_pictforminfo_iterator_t it = xcb_render_query_pict_formats_formats_iterator(formats);
+    for ( ; it.rem; xcb_render_pictforminfo_next(&it)) {
+        const xcb_render_pictforminfo_t *f = it.data;
+        const xcb_render_directformat_t &d = f->direct;
+        if (f->type != XCB_RENDER_PICT_TYPE_DIRECT) continue;
+        if (f->depth == 8 && d.alpha_mask == 0xff && d.alpha_shift == 0 &&
+            d.red_mask == 0 && d.green_mask == 0 && d.blue_mask == 0)
+            m_a8_format = f->id;
+        // the same BGRX layout drawable uploads in
+        if (f->depth == m_depth && d.alpha_mask == 0 &&
+            d.red_mask == 0xff && d.red_shift == 16 &&
+            d.green_mask == 0xff && d.green_shift == 8 &&
+            d.blue_mask == 0xff && d.blue_shift == 0)
+            m_rgb_format = f->id;
+    }
+    free(formats);
+    if (m_a8_format == 0 || m_rgb_format == 0) return false;
+
+    m_picture = xcb_generate_id(m_connection);
+    xcb_render_create_picture(m_connection, m_picture, m_pxid, m_rgb_format, 0, NULL);
+    return true;
+}
+
+void
+pw::Window::upload(const xcb_rectangle_t &rect)
+{
+    const uint32_t dp = IMAGE_STORAGE_DEPTH >> 3;
+    const uint32_t row_bytes = rect.width * dp;
+    const uint32_t header_bytes = 24;   // size of a PutImage request without its data
+    uint32_t rows_per_put = std::max<uint32_t>(1, (m_max_request_bytes - header_bytes) / row_bytes);
+
+    for (uint32_t row = 0; row < rect.height; row += rows_per_put) {
+        uint32_t rows = std::min<uint32_t>(rows_per_put, rect.height - row);
+        const uint8_t *src = drawable + ((size_t)(rect.y + row) * stride + rect.x) * dp;
+        const uint8_t *data = src;
+
+        // full-stride strips are contiguous in drawable; narrower ones are packed first
+        if (rect.width != stride) {
+            m_scratch.resize(rows * row_bytes);
+            for (uint32_t r = 0; r < rows; ++r)
+                memcpy(&m_scratch[r * row_bytes], src + (size_t)r * stride * dp, row_bytes);
+            data = m_scratch.data();
+        }
+
+        xcb_put_image(m_connection,
+                      XCB_IMAGE_FORMAT_Z_PIXMAP,
+                      m_pxid,
+                      m_gcid,
+                      rect.width, rows,
+                      rect.x, rect.y + row,
+                      0,                    // left pad
+                      m_pxfmt->depth,
+                      rows * row_bytes,
+                      data);
+    }
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,351 @@
+#ifndef WRAP_H
+#define WRAP_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "piecetable.h"
+#include "utf8.h"
+
+const uint32_t WRAP_CACHE_ROWS  = 1 << 16;  // layouts kept before the cache starts over
+const uint32_t WRAP_READ_BYTES  = 1 << 16;  // bytes read at a time when measuring a row
+const uint32_t WRAP_BLOCK_BYTES = 1 << 10;  // bytes of a row counted together; an edit decodes one block
+
+/* Design of yano::WrapLayout:
+    1. With soft wrap a buffer row is shown as visual lines of width() cells: visual
+       line k of a row holds its codepoints [k * width(), (k + 1) * width()). A row of n
+       codepoints takes n / width() + 1 visual lines, so a cursor after the last
+       codepoint always has a cell to sit in.
+    2. Measuring a row counts its codepoints the way utf8Decode() splits them, in blocks
+       of about WRAP_BLOCK_BYTES cut where a codepoint starts, noting the bytes and
+       codepoints of the row up to the end of each block. Rows of plain ASCII keep no
+       blocks, since codepoint k is then byte k. The blocks do not depend on the width.
+    3. Rows are measured when first asked about and cached by row. An edit within one
+       row (typing, or a backspace that joins nothing) decodes again only the block it
+       falls in and shifts the counts of the blocks after it. Other edits forget the
+       rows they changed and renumber the ones below; only what the viewport and the
+       cursor ask about gets measured again.
+    4. The byte where a visual line starts, or the visual line of a byte, is a binary
+       search over the blocks and a decode of at most one block, so moving by visual
+       lines costs O(log n + WRAP_BLOCK_BYTES) however long the row is.
+*/
+
+namespace yano
+{
+    // one visual line: part segment of buffer row row
+    typedef struct VisualLine {
+        uint64_t row;
+        uint64_t segment;
+
+        bool operator==(const VisualLine &other) const {
+            return row == other.row && segment == other.segment;
+        }
+        bool operator<(const VisualLine &other) const {
+            return row < other.row || (row == other.row && segment < other.segment);
+        }
+    } VisualLine;
+
+    class WrapLayout
+    {
+        public:
+            // cells per visual line
+            void setWidth(int cols);
+            int  width() { return m_cols; }
+            void clear() { m_rows.clear(); }
+
+            // visual lines row takes; rows past the end of text take one
+            uint64_t lines(PieceTable &text, uint64_t row);
+            // the visual line after (before) line, going on past the end of text; before
+            // the first line is the first line
+            VisualLine next(PieceTable &text, VisualLine line);
+            VisualLine prev(PieceTable &text, VisualLine line);
+
+            // byte of row where its visual line segment starts
+            uint64_t segmentStart(PieceTable &text, uint64_t row, uint64_t segment);
+            // visual line and column of byte (a codepoint start) in row
+            void locate(PieceTable &text, uint64_t row, uint64_t byte, uint64_t &segment, int &col);
+            // byte of row at column col of visual line segment. col is clamped to where a
+            // cursor can go: the cell after the last codepoint on the row's last visual
+            // line, the last cell on the others
+            uint64_t byteAt(PieceTable &text, uint64_t row, uint64_t segment, int &col);
+
+            // rows [first, last] (numbered as before the edit) changed and the text gained
+            // lines lines, negative if it lost some; last may be INT_MAX
+            void edited(uint64_t first, uint64_t last, int64_t lines);
+            // erased bytes at byte of row were replaced by inserted ones, none of them a
+            // newline; text is as after the edit. The row's layout is patched in place
+            void editedWithin(PieceTable &text, uint64_t row, uint64_t byte, uint64_t erased, uint64_t inserted);
+
+        private:
+            // the bytes and codepoints of a row up to the end of one of its blocks
+            typedef struct Block {
+                uint64_t  bytes;
+                uint64_t  codepoints;
+            } Block;
+
+            typedef struct Row {
+                uint64_t            codepoints;
+                uint64_t            bytes;
+                std::vector<Block>  blocks;     // in order; empty for ASCII
+            } Row;
+
+            // row's layout, measuring it on first use. Valid until the next call
+            const Row &measure(PieceTable &text, uint64_t row);
+            // decode bytes [from, to) of the row at row_start, which has row_bytes bytes and
+            // codepoints codepoints before from, adding their blocks. False if the last
+            // codepoint runs on past to
+            bool count(PieceTable &text, uint64_t row_start, uint64_t row_bytes, uint64_t from,
+                       uint64_t codepoints, uint64_t to, std::vector<Block> &blocks);
+            // byte where codepoint codepoint of row, laid out as layout, starts
+            uint64_t byteOf(PieceTable &text, uint64_t row, const Row &layout, uint64_t codepoint);
+            // byte col codepoints on from byte start of the row at offset row_start, going
+            // no further than byte end; col is set to the codepoints there were
+            uint64_t advance(PieceTable &text, uint64_t row_start, uint64_t start, int &col, uint64_t end);
+
+            std::map<uint64_t, Row>  m_rows;
+            Row                      m_blank = { 0, 0, {} };
+            int                      m_cols = 1;
+            std::vector<char>        m_bytes;       // text read for measuring and decoding
+    };
+};
+
+void
+yano::WrapLayout::setWidth(int cols)
+{
+    m_cols = std::max(cols, 1);
+}
+
+const yano::WrapLayout::Row &
+yano::WrapLayout::measure(PieceTable &text, uint64_t row)
+{
+    auto it = m_rows.find(row);
+    if (it != m_rows.end()) return it->second;
+
+    // empty rows, and rows past the end, are cheaper to look up than to keep
+    uint64_t start = text.lineStart(row);
+    uint64_t bytes = text.lineLength(row);
+    if (bytes == 0) return m_blank;
+    if (m_rows.size() >= WRAP_CACHE_ROWS) m_rows.clear();
+
+    Row &layout = m_rows[row];
+    layout.bytes = bytes;
+    layout.blocks.clear();
+    count(text, start, bytes, 0, 0, bytes, layout.blocks);
+    layout.codepoints = layout.blocks.back().codepoints;
+    // one byte per codepoint makes every byte a codepoint start
+    if (layout.codepoints == bytes) std::vector<Block>().swap(layout.blocks);
+    return layout;
+}
+
+bool
+yano::WrapLayout::count(PieceTable &text, uint64_t row_start, uint64_t row_bytes, uint64_t from,
+                        uint64_t codepoints, uint64_t to, std::vector<Block> &blocks)
+{
+    // read in blocks; a sequence cut off at the end of one is decoded again with the next,
+    // and one starting just before to is read whole
+    m_bytes.resize(std::max<uint64_t>(m_bytes.size(), std::min<uint64_t>(to - from + 4, WRAP_READ_BYTES)));
+    uint64_t block_start = from;
+    uint64_t done = from;
+    while (done < to) {
+        uint64_t want = std::min<uint64_t>({ row_bytes - done, to - done + 4, WRAP_READ_BYTES });
+        uint64_t n = text.read(row_start + done, m_bytes.data(), want);
+        bool last = done + n == row_bytes;
+        uint64_t i = 0;
+        while (i < n && done + i < to && (last || i + 4 <= n)) {
+            if (done + i - block_start >= WRAP_BLOCK_BYTES) {
+                blocks.push_back({ done + i, codepoints });
+                block_start = done + i;
+            }
+            ++codepoints;
+            if ((uint8_t)m_bytes[i] < 0x80) {
+                ++i;
+                continue;
+            }
+            uint32_t codepoint;
+            i += utf8Decode(&m_bytes[i], n - i, &codepoint);
+        }
+        done += i;
+    }
+    if (done != to) return false;
+    if (to > block_start || blocks.empty()) blocks.push_back({ to, codepoints });
+    return true;
+}
+
+uint64_t
+yano::WrapLayout::byteOf(PieceTable &text, uint64_t row, const Row &layout, uint64_t codepoint)
+{
+    if (layout.blocks.empty()) return codepoint;
+    if (codepoint >= layout.codepoints) return layout.bytes;
+    // decode from the start of the block codepoint is in
+    auto it = std::upper_bound(layout.blocks.begin(), layout.blocks.end(), codepoint,
+                               [](uint64_t c, const Block &block) { return c < block.codepoints; });
+    uint64_t from = (it == layout.blocks.begin()) ? 0 : (it - 1)->bytes;
+    uint64_t before = (it == layout.blocks.begin()) ? 0 : (it - 1)->codepoints;
+    int col = codepoint - before;
+    return advance(text, text.lineStart(row), from, col, it->bytes);
+}
+
+uint64_t
+yano::WrapLayout::lines(PieceTable &text, uint64_t row)
+{
+    return measure(text, row).codepoints / m_cols + 1;
+}
+
+yano::VisualLine
+yano::WrapLayout::next(PieceTable &text, VisualLine line)
+{
+    if (line.segment + 1 < lines(text, line.row)) return { line.row, line.segment + 1 };
+    return { line.row + 1, 0 };
+}
+
+yano::VisualLine
+yano::WrapLayout::prev(PieceTable &text, VisualLine line)
+{
+    if (line.segment > 0) return { line.row, line.segment - 1 };
+    if (line.row == 0) return line;
+    return { line.row - 1, lines(text, line.row - 1) - 1 };
+}
+
+uint64_t
+yano::WrapLayout::segmentStart(PieceTable &text, uint64_t row, uint64_t segment)
+{
+    const Row &layout = measure(text, row);
+    segment = std::min(segment, layout.codepoints / m_cols);
+    return byteOf(text, row, layout, segment * m_cols);
+}
+
+uint64_t
+yano::WrapLayout::advance(PieceTable &text, uint64_t row_start, uint64_t start, int &col, uint64_t end)
+{
+    // a codepoint takes at most 4 bytes
+    uint64_t length = std::min<uint64_t>(end - start, 4 * (uint64_t)col);
+    m_bytes.resize(std::max<uint64_t>(m_bytes.size(), length));
+    length = text.read(row_start + start, m_bytes.data(), length);
+    uint64_t i = 0;
+    int c = 0;
+    for ( ; c < col && i < length; ++c) {
+        uint32_t codepoint;
+        i += utf8Decode(&m_bytes[i], length - i, &codepoint);
+    }
+    col = c;
+    return start + i;
+}
+
+void
+yano::WrapLayout::locate(PieceTable &text, uint64_t row, uint64_t byte, uint64_t &segment, int &col)
+{
+    const Row &layout = measure(text, row);
+    uint64_t codepoint = byte;
+    if (!layout.blocks.empty()) {
+        // the codepoints before byte: those of the blocks before its own, and the ones in
+        // its block up to it
+        auto it = std::upper_bound(layout.blocks.begin(), layout.blocks.end(), byte,
+                                   [](uint64_t b, const Block &block) { return b < block.bytes; });
+        uint64_t from = (it == layout.blocks.begin()) ? 0 : (it - 1)->bytes;
+        codepoint = (it == layout.blocks.begin()) ? 0 : (it - 1)->codepoints;
+        uint64_t length = byte - from;
+        m_bytes.resize(std::max<uint64_t>(m_bytes.size(), length));
+        text.read(text.lineStart(row) + from, m_bytes.data(), length);
+        codepoint += utf8Length(m_bytes.data(), length);
+    }
+    segment = codepoint / m_cols;
+    col = codepoint % m_cols;
+}
+
+uint64_t
+yano::WrapLayout::byteAt(PieceTable &text, uint64_t row, uint64_t segment, int &col)
+{
+    const Row &layout = measure(text, row);
+    uint64_t last = layout.codepoints / m_cols;
+    segment = std::min(segment, last);
+    int limit = (segment == last) ? (int)(layout.codepoints - last * m_cols) : m_cols - 1;
+    col = std::max(std::min(col, limit), 0);
+    return byteOf(text, row, layout, segment * m_cols + col);
+}
+
+void
+yano::WrapLayout::edited(uint64_t first, uint64_t last, int64_t lines)
+{
+    // the edited rows go; the rows below keep their layouts under their new numbers
+    auto from = m_rows.lower_bound(first);
+    auto to = (last == (uint64_t)INT_MAX) ? m_rows.end() : m_rows.upper_bound(last);
+    m_rows.erase(from, to);
+    if (lines == 0) return;
+
+    std::vector<std::pair<uint64_t, Row>> below;
+    for (auto it = m_rows.upper_bound(last); it != m_rows.end(); it = m_rows.erase(it))
+        below.emplace_back(it->first, std::move(it->second));
+    for (auto &entry : below)
+        m_rows.emplace(entry.first + lines, std::move(entry.second));
+}
+
+void
+yano::WrapLayout::editedWithin(PieceTable &text, uint64_t row, uint64_t byte, uint64_t erased, uint64_t inserted)
+{
+    auto found = m_rows.find(row);
+    if (found == m_rows.end()) return;
+    Row &layout = found->second;
+    uint64_t bytes = layout.bytes - erased + inserted;
+    uint64_t start = text.lineStart(row);
+    if (bytes == 0) {
+        m_rows.erase(found);
+        return;
+    }
+
+    if (layout.blocks.empty()) {
+        // ASCII put in place of ASCII leaves a row of one byte per codepoint
+        m_bytes.resize(std::max<uint64_t>(m_bytes.size(), std::min<uint64_t>(inserted, WRAP_READ_BYTES)));
+        bool ascii = true;
+        for (uint64_t done = 0; ascii && done < inserted; ) {
+            uint64_t n = text.read(start + byte + done, m_bytes.data(), std::min<uint64_t>(inserted - done, WRAP_READ_BYTES));
+            for (uint64_t i = 0; i < n; ++i)
+                ascii = ascii && (uint8_t)m_bytes[i] < 0x80;
+            done += n;
+        }
+        if (ascii) {
+            layout.bytes = layout.codepoints = bytes;
+            return;
+        }
+        // every byte starts a codepoint, so blocks can be cut anywhere
+        for (uint64_t end = WRAP_BLOCK_BYTES; end < layout.bytes + WRAP_BLOCK_BYTES; end += WRAP_BLOCK_BYTES)
+            layout.blocks.push_back({ std::min(end, layout.bytes), std::min(end, layout.bytes) });
+    }
+
+    // the block the edit falls in; an edit at the very end goes into the last one
+    auto it = std::upper_bound(layout.blocks.begin(), layout.blocks.end(), byte,
+                               [](uint64_t b, const Block &block) { return b < block.bytes; });
+    if (it == layout.blocks.end()) --it;
+    // how a sequence just before a block decodes depends on the block's first bytes, so
+    // an edit among them decodes the block before it too
+    auto first = it;
+    uint64_t from = (first == layout.blocks.begin()) ? 0 : (first - 1)->bytes;
+    while (first != layout.blocks.begin() && byte < from + 4) {
+        --first;
+        from = (first == layout.blocks.begin()) ? 0 : (first - 1)->bytes;
+    }
+    uint64_t before = (first == layout.blocks.begin()) ? 0 : (first - 1)->codepoints;
+    std::vector<Block> blocks;
+    if (byte + erased > it->bytes || !count(text, start, bytes, from, before, it->bytes - erased + inserted, blocks)) {
+        // the edit left a sequence running over the block's end; measure the row afresh
+        m_rows.erase(found);
+        return;
+    }
+
+    int64_t byte_shift = (int64_t)inserted - (int64_t)erased;
+    int64_t codepoint_shift = (int64_t)blocks.back().codepoints - (int64_t)it->codepoints;
+    for (auto after = it + 1; after != layout.blocks.end(); ++after) {
+        after->bytes += byte_shift;
+        after->codepoints += codepoint_shift;
+    }
+    size_t at = first - layout.blocks.begin();
+    layout.blocks.erase(first, it + 1);
+    layout.blocks.insert(layout.blocks.begin() + at, blocks.begin(), blocks.end());
+    layout.bytes = bytes;
+    layout.codepoints += codepoint_shift;
+    if (layout.codepoints == bytes) std::vector<Block>().swap(layout.blocks);
+}
+
+#endif
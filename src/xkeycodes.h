@@ -2,6 +2,7 @@
 #define XKEYCODES_H
 
 #include <stdint.h>
+#include <string.h>
 
 enum XKEYCODE {
     ESC = 9,
@@ -13,6 +14,7 @@ enum XKEYCODE {
     ALT_L = 64, SPACE, CTRL_L,
     F1, F2, F3, F4, F5, F6, F7, F8, F9, F10,
     NUM_LOCK, SCROLL_LOCK,
+    F11 = 95, F12,
     CTRL_R = 105,
     PRINT = 107,
     ALT_R,
@@ -26,6 +28,8 @@ class XToAscii
 {
     public:
         XToAscii() {
+            // keys without an entry convert to 0
+            memset(m_table, 0, sizeof(m_table));
             m_table[ONE][0]   = '1';
             m_table[ONE][1]   = '!';
             m_table[TWO][0]   = '2';
@@ -75,6 +79,7 @@ class XToAscii
             m_table[BRACKET_R][0] = ']';
             m_table[BRACKET_R][1] = '}';
             m_table[RETURN][0] = '\n';
+            m_table[RETURN][1] = '\n';
             m_table[A][0]      = 'a';
             m_table[A][1]      = 'A';
             m_table[S][0]      = 's';
@@ -121,7 +126,8 @@ class XToAscii
             m_table[PERIOD][1] = '>';
             m_table[SLASH][0]  = '/';
             m_table[SLASH][1]  = '?';
-            m_table[SPACE][0]  = 0;
+            m_table[SPACE][0]  = ' ';
+            m_table[SPACE][1]  = ' ';
         }
 
         char convert(int kc, int modifier) {
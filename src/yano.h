@@ -1,45 +1,203 @@
 #ifndef YANO_H
 #define YANO_H
 
-#include <filesystem>
-#include <fstream>
-#include <list>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <unistd.h>
 #include <thread>
 
+#include "alloc.h"
+#include "blit.h"
+#include "eventloop.h"
+#include "font.h"
+#include "frame.h"
+#include "highlight.h"
+#include "indexer.h"
+#include "metrics.h"
+#include "piecetable.h"
+#include "replay.h"
+#include "search.h"
+#include "tail.h"
+#include "threadpool.h"
+#include "undo.h"
+#include "utf8.h"
 #include "windowing.h"
+#include "wrap.h"
 #include "xkeycodes.h"
 
-// note that XCB cannot accept resolutions (W, H) where WxH >= 2^22.
-// Limit window creation to at most 2560x1600.
+const yano::Cell NO_CELL = { 0xffffffff, 0 };  // never a codepoint; marks cells whose pixels are stale
+const yano::VisualLine NO_LINE = { UINT64_MAX, 0 };  // never shown; marks grid rows to lay out
+const char      *CONFIG_DIR = "../config";      // fonts and grammars
+const uint64_t   WRAP_COLOR_BYTES = 16 << 10;   // wrapped parts of a row further in are drawn plain
+const uint64_t   CURSOR_READ_BYTES = 4 << 10;   // bytes read at a time when counting the cursor's column
+
+/* Threads in yano::Yano:
+    1. The editor thread (run()) owns the TextBuffer and m_grid. Edits lay text out
+       into m_grid, and publishFrame() hands a copy to the render thread. Scratch space
+       for one batch comes from m_frame_arena, so typing makes no heap allocations once
+       the grid, arena and piece table pools have grown to size.
+    2. The render thread (redraw()) is the only writer of drawable. m_grid is the back
+       screen and m_shown the front: rows whose hash matches are skipped, and within
+       the rest only cells that differ are drawn. It presents at most once per refresh.
+    3. m_grid is a viewport onto the buffer starting at visual line m_top, with long rows
+       soft-wrapped (see WrapLayout); m_view records which visual line each grid row
+       shows. Scrolling moves the grid rows and drawn pixels that stay on screen instead
+       of redoing them, so both threads only lay out and rasterize the rows that scroll
+       into view.
+    4. The editor thread lays the grid out for the backend's configuredSize(); each frame
+       carries the size it was laid out for, and the render thread resizes drawable to
+       it before drawing, so a resize never lands in the middle of a frame.
+*/
 namespace yano
 {
     class Yano
     {
         public:
+            // opens an X window of the given size
             Yano(int16_t     windowWidth,
                  int16_t     windowHeight,
                  std::string font,
                  uint8_t     fontScale);
+            // draws to backend, which it takes ownership of
+            Yano(pw::Backend *backend,
+                 std::string  font,
+                 uint8_t      fontScale);
             ~Yano();
             int run();
 
+            // one turn of the editor on the calling thread, in place of run(): handle queued
+            // input, lay out and publish, then draw and present the frame. For driving a
+            // headless backend; false if there was no new frame to draw
+            bool step();
+            const Metrics &metrics() { return m_metrics; }
+            // FNV-1a of the whole buffer and the cursor's byte offset, to compare runs
+            uint64_t textChecksum();
+            uint64_t cursorOffset() { return m_text_buffer.m_cursor_position.offset; }
+            // whether rows of the file are still waiting for syntax colors
+            bool highlighting() { return !m_highlighter.complete(); }
+            // cells per visual line of soft-wrapped text
+            int  wrapWidth() { return m_wrap.width(); }
+
+            // the editor thread's event loop; other subsystems register fds and timers here
+            EventLoop &eventLoop() { return m_loop; }
+
+            // load path into the buffer (a missing file starts empty) and paint it
+            bool openFile(const std::string &path);
+            bool saveFile();
+            // follow the open file as another process appends to it (see Tail), from its
+            // end; a cursor on the last row stays there. False if it cannot be watched
+            bool follow(bool on);
+
+            // colors are 32-bit BGRX pixels, as stored in drawable
+            typedef struct colorTheme {
+                uint32_t foreground;
+                uint32_t background;
+            } colorTheme;
+
+            // both cause the render thread to rebuild the glyph atlas and repaint
+            void setFontScale(uint8_t fontScale);
+            void setTheme(const colorTheme &theme);
+
+            // render thread: draw and present frames as they are published
             void redraw() {
-                while (!m_window->shouldClose()) {
-                    m_window->display(0, 0, m_window->window_width, m_window->window_height);
-                    usleep(100000/m_refresh_rate);
+                const auto period = std::chrono::nanoseconds(1000000000 / m_refresh_rate);
+                auto deadline = std::chrono::steady_clock::now();
+                while (m_mailbox.wait()) {
+                    // present at most once per refresh; frames published meanwhile coalesce
+                    std::this_thread::sleep_until(deadline);
+                    const Frame *frame = m_mailbox.acquire();
+                    if (frame == nullptr) continue;
+                    presentFrame(*frame);
+                    deadline = std::max(deadline + period, std::chrono::steady_clock::now());
                 }
             }
 
         private:
-            pw::Window                            *m_window;
+            pw::Backend                           *m_window;
             uint8_t                                m_refresh_rate;
             uint8_t                                m_font_scale;
-            std::vector<std::vector<std::string>>  m_glyphs;
+            Font                                   m_font;
+            colorTheme                             m_theme;
             XToAscii                              *m_keycode_table;
+            Metrics                                m_metrics;   // recorded by both threads
+
+            // editor thread state
+            Frame                                  m_grid;      // what the screen should show
+            uint16_t                               m_width = 0; // window size m_grid is laid out for
+            uint16_t                               m_height = 0;
+            bool                                   m_grid_dirty = false;
+            std::vector<char>                      m_line_bytes;
+            Arena                                  m_frame_arena;  // scratch, reset after each frame
+            std::vector<pw::KeyEvent>              m_keys;      // this wakeup's key presses
+            std::string                            m_typed;     // characters not yet inserted
+            int                                    m_invalid_first = INT_MAX; // buffer rows to lay out again
+            int                                    m_invalid_last = -1;
+            WrapLayout                             m_wrap;      // buffer rows measured into visual lines
+            VisualLine                             m_top = { 0, 0 };  // shown in the first grid row
+            std::vector<VisualLine>                m_view;      // shown in each grid row, as laid out
+            bool                                   m_view_stale = false;  // some row of m_view is NO_LINE
+            int                                    m_goal_col = -1;   // column UP and DOWN keep to
+            size_t                                 m_cursor_cell = SIZE_MAX; // cell marked ATTR_INVERSE
+            FrameMailbox                           m_mailbox;
+            EventLoop                              m_loop;
+            uint64_t                               m_input_time = 0; // oldest key not yet published
+            uint64_t                               m_edit_time = 0;  // when its edits were applied
+            uint64_t                               m_published_input = 0; // input_time of the last frame
+            SessionRecorder                        m_recorder;  // keys to $YANO_RECORD, if set
+
+            // latency overlay (F12) over the top right of the grid, refreshed on a timer so
+            // that drawing it does not feed the numbers it shows
+            bool                                   m_overlay = false;
+            int                                    m_overlay_timer = -1;
+            char                                   m_overlay_text[STAGE_COUNT + 1][METRICS_LINE_WIDTH + 1];
+
+            // background newline index of the open file
+            LineIndexer                            m_indexer;
+            int                                    m_index_wakeup = -1;
+            bool                                   m_indexing = false;
+
+            // follow mode: bytes appended to the open file are taken in as they arrive
+            Tail                                   m_tail;
+            int                                    m_tail_wakeup = -1;
+            bool                                   m_follow = false;
+
+            // syntax colors of the open file; lines off screen are lexed on its own thread
+            Highlighter                            m_highlighter;
+            int                                    m_highlight_wakeup = -1;
+
+            // find (Ctrl+F) and goto-line (Ctrl+G) prompts, drawn over the last grid row
+            enum PromptKind { PROMPT_NONE, PROMPT_FIND, PROMPT_GOTO };
+            ThreadPool                             m_pool;
+            Search                                 m_search{m_pool};
+            int                                    m_search_wakeup = -1;
+            PromptKind                             m_prompt = PROMPT_NONE;
+            std::string                            m_query;
+            int64_t                                m_goto_pending = -1; // row waiting on the indexer
+            std::vector<Match>                     m_matches;   // in document order, as they stream in
+            bool                                   m_search_done = true;
+            size_t                                 m_match = SIZE_MAX; // the one the cursor is on
+            bool                                   m_jump_pending = false;
+            uint64_t                               m_jump_from = 0;    // jump to the first match here or later
+
+            // render thread state
+            std::vector<uint32_t>                  m_atlas;     // [slot][cell_h][cell_w] pixels
+            std::vector<int32_t>                   m_atlas_slots; // per glyph and attr; -1 until drawn
+            std::vector<int32_t>                   m_glyph_ids; // per glyph, its id in the backend; -1 until sent
+            uint32_t                               m_glyph_count = 0;
+            std::vector<uint32_t>                  m_run_ids;   // glyph ids of the run being drawn
+            std::vector<uint32_t>                  m_coverage;  // a glyph expanded for addGlyph()
+            std::vector<Cell>                      m_shown;     // cells as last drawn
+            std::vector<uint64_t>                  m_shown_hash;
+            int64_t                                m_shown_top = 0;
+            uint8_t                                m_drawn_scale = 0;
+            uint32_t                               m_drawn_palette[ATTR_COLORS] = {};
+            uint32_t                               m_drawn_background = 0;
 
             typedef struct glyphProperties {
                 uint8_t global_bbox_w;
@@ -50,126 +208,303 @@ namespace yano
 
             glyphProperties                        m_glyph_properties;
 
-            void keyHandler(xcb_keycode_t keycode,
-                            uint32_t     *modifiers);
-
-            void drawGlyph(int row, int col, int scale, uint8_t keycode) {
-                int xoffset = scale * col * m_glyph_properties.global_bbox_w;
-                int yoffset = scale * row * m_glyph_properties.global_bbox_h;
-
-                printf("%d, %d\n", xoffset, m_glyph_properties.global_bbox_w);
-
-                int dp = (IMAGE_STORAGE_DEPTH >> 3);
-                int p = (yoffset * m_window->window_width + xoffset) * dp;
-
-                // string of 0s and 1s
-                for (std::string &bitline : m_glyphs[keycode]) {
-                    int p1 = p;
-                    for (int c = 0; c < (int)bitline.size(); ++c) {
-                        int p2 = p;
-                        if (bitline[c] == '1') {
-                            for (int i = 0; i < scale; ++i) {
-                                for (int j = 0; j < scale; ++j) {
-                                    m_window->drawable[p+j*dp+0] = 172; //244; // red
-                                    m_window->drawable[p+j*dp+1] = 129; //239; // green
-                                    m_window->drawable[p+j*dp+2] = 94; //236; // blue
-                                }
-                                p += m_window->window_width*dp;
-                            }
-                        } else {
-                            for (int i = 0; i < scale; ++i) {
-                                for (int j = 0; j < scale; ++j) {
-                                    m_window->drawable[p+j*dp+0] = 64; //172;
-                                    m_window->drawable[p+j*dp+1] = 52; //129;
-                                    m_window->drawable[p+j*dp+2] = 46; //94;
-                                }
-                                p += m_window->window_width*dp;
-                            }
-                        }
-                        p = p2 + scale * dp;
-                    }
-                    p = p1 + scale * m_window->window_width*dp;
+            // editor thread: everything between waits for input
+            void update();
+            void keyHandler(const pw::KeyEvent &key);
+            // handle every event queued on the X connection as one batch
+            void handleEvents();
+            // insert the run of typed characters collected so far in one edit
+            void flushTyped();
+            // undo or redo a group of edits and lay out what it changed
+            void undo(bool redo);
+
+            // keys typed while the find prompt is open
+            void promptKey(const pw::KeyEvent &key);
+            void closePrompt();
+            // search for m_query; a leading '/' makes the rest a regex
+            void startSearch();
+            // take in streamed matches and make any jump that was waiting for them
+            void searchProgress();
+            void jumpToMatch(size_t i);
+            // lay the prompt out over the last grid row
+            void drawPrompt();
+            void toggleOverlay();
+            // format the current percentiles into m_overlay_text
+            void refreshOverlay();
+            // lay m_overlay_text out over the top right of the grid
+            void drawOverlay();
+            bool overlayCovers(int row, int col) {
+                return m_overlay && row <= STAGE_COUNT && col >= m_grid.cols - (int)METRICS_LINE_WIDTH;
+            }
+            // index the text not scanned yet on the indexer's thread
+            void startIndexer();
+            // take in the indexer's progress and make a goto that was waiting for it
+            void indexProgress();
+            // watch the file at the buffer's path, of which the buffer holds all there is
+            bool watchFile();
+            // take in what the followed file gained, or open it again if it was replaced
+            void tailProgress();
+            // take in the highlighter's progress, laying out the rows it colored
+            void highlightProgress();
+            // move the cursor to the start of row, once the index reaches it
+            void gotoLine(int64_t row);
+            // mark buffer rows [first, last] as needing layout; INT_MAX means to the bottom
+            void invalidate(int first, int last) {
+                m_invalid_first = std::min(m_invalid_first, first);
+                m_invalid_last = std::max(m_invalid_last, last);
+            }
+            // buffer rows [first, last] were edited and the text had lines_before lines;
+            // invalidates them and whatever rows the edit recolored
+            void edited(int first, int last, uint64_t lines_before);
+            // erased bytes at byte of row were replaced by inserted ones, none of them a
+            // newline; the row's wrap layout is patched rather than measured again
+            void editedWithin(int row, uint64_t byte, uint64_t erased, uint64_t inserted);
+            // lay out grid rows [first, last] again, whatever they show
+            void invalidateGrid(int first, int last) {
+                for (int row = std::max(first, 0); row <= std::min(last, m_grid.rows - 1); ++row)
+                    m_view[row] = NO_LINE;
+                m_view_stale = true;
+            }
+            // lay out the invalidated rows that are on screen, once per batch
+            void layoutInvalid();
+            // show visual line top in the first grid row, keeping rows that stay visible
+            void scrollTo(VisualLine top);
+            // scroll just enough to bring the cursor's visual line on screen
+            void followCursor();
+
+            // the visual line the cursor is on, and its column there
+            VisualLine cursorLine(int &col);
+            // put the cursor at col of line, or as near as it can go
+            void moveCursor(VisualLine line, int col);
+            // move the cursor down lines visual lines (up if negative), keeping to m_goal_col
+            void moveLines(int64_t lines);
+            // move the cursor to the start or end of its visual line
+            void moveToLineEdge(bool end);
+
+            // size m_grid to the window at the current font scale, blanking it
+            void layoutGrid();
+            // lay out every row of the viewport
+            void drawText();
+            // lay out visual line m_view[row] into row of m_grid
+            void drawLine(int row);
+            // recompute the hash of one row of m_grid
+            void hashRow(int row) {
+                m_grid.row_hash[row] = rowHash(&m_grid.cells[row * m_grid.cols], m_grid.cols);
+            }
+            // move the ATTR_INVERSE cell to the cursor
+            void placeCursor();
+            void clearCursor();
+            // hand a copy of m_grid to the render thread
+            void publishFrame();
+
+            // render thread: draw the cells of frame that changed since the last one
+            void renderFrame(const Frame &frame);
+            // render thread: renderFrame() and present, timing both
+            void presentFrame(const Frame &frame);
+
+            // copy one pre-rasterized glyph from the atlas into its cell
+            void drawGlyph(int row, int col, const Cell &cell) {
+                int cell_w = m_drawn_scale * m_glyph_properties.global_bbox_w;
+                int cell_h = m_drawn_scale * m_glyph_properties.global_bbox_h;
+                int xoffset = col * cell_w;
+                int yoffset = row * cell_h;
+                if (xoffset + cell_w > m_window->window_width ||
+                    yoffset + cell_h > m_window->window_height)
+                    return;
+
+                const uint32_t *src = &m_atlas[atlasSlot(m_font.glyph(cell.codepoint), cell.attr) * cell_w * cell_h];
+                uint32_t *dst = (uint32_t *)m_window->drawable + (size_t)yoffset * m_window->stride + xoffset;
+                for (int y = 0; y < cell_h; ++y) {
+                    memcpy(dst, src, cell_w * sizeof(uint32_t));
+                    src += cell_w;
+                    dst += m_window->stride;
                 }
+
+                m_window->damage(xoffset, yoffset, cell_w, cell_h);
+            }
+            // draw count cells of one attr from (row, col): as glyph ids when the backend
+            // keeps glyphs, otherwise one drawGlyph() each
+            void drawRun(int row, int col, const Cell *cells, int count);
+
+            // reset the atlas (or the backend's glyphs) for m_drawn_scale and m_drawn_palette
+            void buildAtlas();
+            // render thread: the colors a cell with attr is drawn in
+            void cellColors(uint32_t attr, uint32_t &fg, uint32_t &bg) {
+                fg = m_drawn_palette[attrColor(attr)];
+                bg = m_drawn_background;
+                if (attr & ATTR_INVERSE) std::swap(fg, bg);
             }
+            // atlas slot holding glyph drawn with attr, rasterizing it on first use
+            uint32_t atlasSlot(uint32_t glyph, uint32_t attr);
+            // the backend's id for glyph, uploading it on first use
+            uint32_t glyphId(uint32_t glyph);
 
             class TextBuffer
             {
                 public:
-                    TextBuffer() {
-                        m_lines.push_back(std::list<char>());
-                        m_cursor_position.curr_row = m_lines.begin();
-                        m_cursor_position.curr_col = m_cursor_position.curr_row->begin();
+                    // scratch is used for temporary copies of text
+                    explicit TextBuffer(Arena &scratch) : m_scratch(scratch) {
+                        m_cursor_position.offset = 0;
+                        m_cursor_position.row_coord = 0;
+                        m_cursor_position.col_coord = 0;
+                    }
 
+                    // map is passed on to PieceTable::open()
+                    bool open(const std::string &path, bool map = true) {
+                        m_path = path;
+                        m_cursor_position.offset = 0;
                         m_cursor_position.row_coord = 0;
                         m_cursor_position.col_coord = 0;
+                        m_undo.clear();     // the log points into the old buffers
+                        return m_text.open(path.c_str(), map);
+                    }
+
+                    bool save() {
+                        if (m_path.empty()) return false;
+                        m_undo.seal();
+                        return m_text.save(m_path.c_str());
+                    }
+
+                    // reverse/replay a group of edits; [first, last] is set to the offsets
+                    // changed, as the text is afterwards
+                    bool undo(uint64_t &first, uint64_t &last) {
+                        uint64_t cursor;
+                        if (!m_undo.undo(m_text, first, last, cursor)) return false;
+                        moveToOffset(cursor);
+                        return true;
+                    }
+                    bool redo(uint64_t &first, uint64_t &last) {
+                        uint64_t cursor;
+                        if (!m_undo.redo(m_text, first, last, cursor)) return false;
+                        moveToOffset(cursor);
+                        return true;
+                    }
+
+                    // put the cursor at a byte offset that starts a codepoint. The row comes
+                    // from the piece table's newline index in O(log n); the column counts the
+                    // codepoints before offset on its line. Typing keeps both up to date
+                    // itself, so this is for jumps: undo, redo, search and joined lines
+                    void moveToOffset(uint64_t offset) {
+                        uint64_t row = m_text.rowOf(offset);
+                        uint64_t line_start = m_text.lineStart(row);
+                        m_cursor_position.offset = offset;
+                        m_cursor_position.row_coord = row;
+                        uint64_t bytes;
+                        m_cursor_position.col_coord = countCodepoints(line_start, offset - line_start, UINT64_MAX, bytes);
+                    }
+
+                    // put the cursor on row at column col, clamped to the text
+                    void moveTo(int row, int col) {
+                        // looking row up indexes far enough to tell whether it exists
+                        m_text.lineStart(std::max(row, 0));
+                        row = std::min<uint64_t>(std::max(row, 0), m_text.lineCount() - 1);
+                        uint64_t start = m_text.lineStart(row);
+
+                        // col codepoints take at most 4 * col bytes
+                        uint64_t length = std::min<uint64_t>(m_text.lineLength(row), 4 * (uint64_t)std::max(col, 0));
+                        uint64_t bytes;
+                        uint64_t c = countCodepoints(start, length, std::max(col, 0), bytes);
+                        m_cursor_position.offset = start + bytes;
+                        m_cursor_position.row_coord = row;
+                        m_cursor_position.col_coord = c;
+                        m_undo.seal();
+                    }
+
+                    // put the cursor at offset, already known to be codepoint col of row;
+                    // for moves that found both without reading the row up to offset
+                    void moveToKnown(uint64_t offset, int row, int col) {
+                        m_cursor_position.offset = offset;
+                        m_cursor_position.row_coord = row;
+                        m_cursor_position.col_coord = col;
+                        m_undo.seal();
                     }
 
                     void addChar(char ch) {
-                        // if iterator is at end of current line
-                        if (m_cursor_position.curr_row->size() == 0 ||
-                            next(m_cursor_position.curr_col) == m_cursor_position.curr_row->end())
-                        {
-                            m_cursor_position.curr_row->push_back(ch);
-                            m_cursor_position.curr_col = prev(m_cursor_position.curr_row->end());
-                            m_cursor_position.col_coord++;
-                            if (ch == '\n') {
-                                m_lines.push_back(std::list<char>());
-                                m_cursor_position.curr_row++;
-                                m_cursor_position.curr_col = m_cursor_position.curr_row->begin();
-                                m_cursor_position.row_coord++;
-                                m_cursor_position.col_coord = 0;
-                            }
-                        } else {
-                            m_cursor_position.curr_row->insert(next(m_cursor_position.curr_col), ch);
-                            m_cursor_position.curr_col++;
-                            m_cursor_position.col_coord++;
-                            // split the current line
-                            if (ch == '\n') {
-                                auto newPos = m_lines.insert(next(m_cursor_position.curr_row), std::list<char>());
-                                newPos->splice(newPos->begin(), *m_cursor_position.curr_row,
-                                               m_cursor_position.curr_col, m_cursor_position.curr_row->end());
-                                m_cursor_position.curr_row->erase(m_cursor_position.curr_col, m_cursor_position.curr_row->end());
-                                m_cursor_position.curr_col = newPos->begin();
-                                m_cursor_position.row_coord++;
-                                m_cursor_position.col_coord = 0;
-                            }
+                        addCodepoint((uint8_t)ch);
+                    }
+
+                    // insert UTF-8 text at the cursor as one edit, leaving the cursor after it
+                    void addText(const char *text, uint64_t length) {
+                        m_text.insert(m_cursor_position.offset, text, length);
+                        m_undo.recordInsert(m_text, m_cursor_position.offset, length);
+                        m_cursor_position.offset += length;
+
+                        // only the inserted bytes are counted, however long the line
+                        const char *last_newline = (const char *)memrchr(text, '\n', length);
+                        if (last_newline == NULL) {
+                            m_cursor_position.col_coord += utf8Length(text, length);
+                            return;
                         }
+                        m_cursor_position.row_coord += std::count(text, last_newline + 1, '\n');
+                        m_cursor_position.col_coord =
+                            utf8Length(last_newline + 1, text + length - (last_newline + 1));
+                    }
+
+                    void addCodepoint(uint32_t codepoint) {
+                        char bytes[4];
+                        addText(bytes, utf8Encode(codepoint, bytes));
                     }
 
                     void delChar() {
-                        // if iterator is at beginning of current line
-                        if (m_cursor_position.curr_col == m_cursor_position.curr_row->end()) {
-                            // can only delete if not at beginning of file
-                            if (m_cursor_position.curr_row != m_lines.begin()) {
-                                m_cursor_position.curr_row--;
-                                m_lines.erase(next(m_cursor_position.curr_row));
-                                // erase the '\n'
-                                m_cursor_position.curr_row->erase(prev(m_cursor_position.curr_row->end()));
-                                m_cursor_position.curr_col = prev(m_cursor_position.curr_row->end());
-                                m_cursor_position.row_coord--;
-                                m_cursor_position.col_coord = m_cursor_position.curr_row->size();
-                            }
+                        // can only delete if not at beginning of file
+                        if (m_cursor_position.offset == 0) return;
+
+                        // back up over continuation bytes to the start of the codepoint
+                        uint64_t start = m_cursor_position.offset - 1;
+                        while (start > 0 && m_cursor_position.offset - start < 4 &&
+                               utf8Continuation(m_text.charAt(start)))
+                            --start;
+
+                        bool joined = m_text.charAt(start) == '\n';
+                        m_undo.recordErase(m_text, start, m_cursor_position.offset - start);
+                        m_text.erase(start, m_cursor_position.offset - start);
+                        if (joined) {
+                            // onto the end of the previous line, whose length is not known
+                            moveToOffset(start);
                         } else {
-                            m_cursor_position.curr_col--;
-                            m_cursor_position.curr_row->erase(next(m_cursor_position.curr_col));
+                            m_cursor_position.offset = start;
                             m_cursor_position.col_coord--;
                         }
                     }
 
-                    std::list<std::list<char>> m_lines;
+                    PieceTable  m_text;
+                    UndoLog     m_undo;
+                    std::string m_path;
+                    Arena      &m_scratch;
 
                     typedef struct CursorPosition {
-                        std::list<std::list<char>>::iterator curr_row;
-                        std::list<char>::iterator curr_col;
-                        // added here for easy reference by Yano
+                        uint64_t offset;    // byte offset into m_text
+                        // kept in step with offset, for easy reference by Yano
                         int row_coord;
                         int col_coord;
                     } CursorPosition;
 
                     CursorPosition m_cursor_position;
+
+                private:
+                    // codepoints in the length bytes at offset, but no more than limit; bytes
+                    // is set to the bytes they take. The text is read a block at a time, and
+                    // a sequence cut off at the end of one is decoded again with the next
+                    uint64_t countCodepoints(uint64_t offset, uint64_t length, uint64_t limit, uint64_t &bytes) {
+                        char *block = m_scratch.allocArray<char>(std::min(length, CURSOR_READ_BYTES));
+                        uint64_t codepoints = 0;
+                        bytes = 0;
+                        while (bytes < length && codepoints < limit) {
+                            uint64_t n = m_text.read(offset + bytes, block, std::min(length - bytes, CURSOR_READ_BYTES));
+                            bool last = bytes + n == length;
+                            uint64_t i = 0;
+                            while (i < n && (last || i + 4 <= n) && codepoints < limit) {
+                                uint32_t codepoint;
+                                i += utf8Decode(&block[i], n - i, &codepoint);
+                                ++codepoints;
+                            }
+                            bytes += i;
+                        }
+                        return codepoints;
+                    }
             };
 
-            TextBuffer                             m_text_buffer;
+            TextBuffer                             m_text_buffer{m_frame_arena};
     };
 };
 
@@ -177,105 +512,1076 @@ yano::Yano::Yano(int16_t windowWidth,
                  int16_t windowHeight,
                  std::string font,
                  uint8_t fontScale)
+    : Yano(new pw::Window(windowWidth, windowHeight, "yano", -1), font, fontScale)
+{
+}
+
+yano::Yano::Yano(pw::Backend *backend,
+                 std::string  font,
+                 uint8_t      fontScale)
 {
-    m_window = new pw::Window(windowWidth, windowHeight, "yano", -1);
+    m_window = backend;
     m_refresh_rate = 60;
     m_font_scale = fontScale;
     m_keycode_table = new XToAscii();
+    m_theme.foreground = 0x005e81ac;
+    m_theme.background = 0x002e3440;
+
+    // load glyphs
+    if (!m_font.load(CONFIG_DIR, font)) exit(1);
+    m_glyph_properties.global_bbox_w = m_font.width();
+    m_glyph_properties.global_bbox_h = m_font.height();
+    m_glyph_properties.global_xoff = m_font.xoff();
+    m_glyph_properties.global_yoff = m_font.yoff();
+
+    m_window->configuredSize(m_width, m_height);
+    m_grid.top = 0;
+    layoutGrid();
+
+    // all are notified from worker threads and handled on the editor thread
+    m_search_wakeup = m_loop.addWakeup([this]() { searchProgress(); });
+    m_index_wakeup = m_loop.addWakeup([this]() { indexProgress(); });
+    m_highlight_wakeup = m_loop.addWakeup([this]() { highlightProgress(); });
+    m_tail_wakeup = m_loop.addWakeup([this]() { tailProgress(); });
+}
+
+yano::Yano::~Yano() {
+    m_search.cancel();      // workers read the text buffer's storage
+    m_indexer.cancel();
+    m_highlighter.cancel();
+    delete(m_keycode_table);
+    delete(m_window);
+}
+
+int
+yano::Yano::run() {
+    const char *session = getenv("YANO_RECORD");
+    if (session != NULL && !m_recorder.open(session))
+        printf("Error: cannot record to %s.\n", session);
+    std::thread render(&yano::Yano::redraw, this);
+
+    // sleep until X has something for us; one frame covers everything handled per wakeup
+    m_loop.addFd(m_window->fd(), EPOLLIN, [this](uint32_t) { handleEvents(); });
+    m_loop.setBeforeWait([this]() { update(); });
+    m_loop.run();
+
+    m_loop.removeFd(m_window->fd());
+    m_search.cancel();
+    m_indexer.cancel();
+    m_mailbox.close();
+    render.join();
+
+    const char *path = getenv("YANO_METRICS");
+    if (path == NULL) path = METRICS_DUMP_PATH;
+    if (!m_metrics.dump(path))
+        printf("Error: cannot write metrics to %s.\n", path);
+
+    return 0;
+}
 
-    // change background color
-    int bits_per_px = IMAGE_STORAGE_DEPTH >> 3;
-    for (int i = 0; i < windowWidth*windowHeight*bits_per_px; i += bits_per_px) {
-        m_window->drawable[i+0] = 64;
-        m_window->drawable[i+1] = 52;
-        m_window->drawable[i+2] = 46;
+bool
+yano::Yano::step()
+{
+    m_loop.dispatch(0);     // search and indexer progress, timers
+    update();
+    const Frame *frame = m_mailbox.acquire();
+    if (frame == nullptr) return false;
+    presentFrame(*frame);
+    return true;
+}
+
+uint64_t
+yano::Yano::textChecksum()
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    m_text_buffer.m_text.forEachRun([&h](const char *data, uint64_t length) {
+        for (uint64_t i = 0; i < length; ++i)
+            h = (h ^ (uint8_t)data[i]) * 0x100000001b3ull;
+        return true;
+    });
+    return h;
+}
+
+void
+yano::Yano::update()
+{
+    // events may already sit in xcb's queue, where epoll cannot see them
+    handleEvents();
+    // laid out first so followCursor() finds the cursor in m_view
+    layoutInvalid();
+    followCursor();
+    layoutInvalid();
+    // after layout, so the thread starts past the rows the screen just lexed
+    int wakeup = m_highlight_wakeup;
+    m_highlighter.resume(m_text_buffer.m_text, [this, wakeup]() { m_loop.notify(wakeup); });
+    if (m_prompt != PROMPT_NONE) drawPrompt();
+    if (m_overlay) drawOverlay();
+    if (m_grid_dirty) publishFrame();
+    m_input_time = 0;   // keys that changed nothing on screen have no latency to show
+    m_frame_arena.reset();
+}
+
+bool
+yano::Yano::openFile(const std::string &path)
+{
+    m_search.cancel();      // the old buffers are about to be unmapped
+    m_indexer.cancel();
+    m_highlighter.cancel();
+    m_matches.clear();
+    // a followed file may be truncated in place, and a mapping of it would then fault
+    if (!m_text_buffer.open(path, !m_follow)) {
+        printf("Error: cannot open %s.\n", path.c_str());
+        return false;
     }
+    m_highlighter.load(CONFIG_DIR, path);
+    m_wrap.clear();
+    m_top = { 0, 0 };
+    startIndexer();
+    drawText();
+    if (m_follow) return follow(true);
+    return true;
+}
 
-    // load glyphs
-    std::string fontDir = "../config/.glyphs/" + font;
-    for (const auto &entry : std::filesystem::directory_iterator(fontDir)) {
-        std::fstream glyphFile;
-        glyphFile.open(entry.path());
+bool
+yano::Yano::saveFile()
+{
+    if (!m_text_buffer.save()) {
+        printf("Error: cannot save %s.\n", m_text_buffer.m_path.c_str());
+        return false;
+    }
+    printf("Saved %s.\n", m_text_buffer.m_path.c_str());
+    // the save renamed a new file over the one followed, and it holds the whole buffer
+    if (m_follow) watchFile();
+    return true;
+}
+
+bool
+yano::Yano::follow(bool on)
+{
+    m_follow = on;
+    if (!on) {
+        m_tail.stop();
+        return true;
+    }
+    // the file was mapped when it was opened; read it instead
+    if (m_text_buffer.m_text.mapsFile()) return openFile(m_text_buffer.m_path);
+    if (!watchFile()) {
+        printf("Error: cannot follow %s.\n", m_text_buffer.m_path.c_str());
+        m_follow = false;
+        return false;
+    }
+    // like tail, start at the end; the goto waits for the indexer if it has to
+    gotoLine(INT64_MAX);
+    return true;
+}
+
+bool
+yano::Yano::watchFile()
+{
+    if (m_text_buffer.m_path.empty()) return false;
+    // inotify is read on the loop, but the buffer may only be reopened from a wakeup:
+    // reopening restarts the watch whose callback is running
+    int wakeup = m_tail_wakeup;
+    return m_tail.start(m_loop, m_text_buffer.m_path, m_text_buffer.m_text.length(),
+                        [this, wakeup]() { m_loop.notify(wakeup); });
+}
+
+void
+yano::Yano::setFontScale(uint8_t fontScale)
+{
+    m_font_scale = fontScale;
+    layoutGrid();
+    drawText();
+}
+
+void
+yano::Yano::setTheme(const colorTheme &theme)
+{
+    m_theme = theme;
+    m_grid_dirty = true;
+}
+
+void
+yano::Yano::layoutGrid()
+{
+    // a window smaller than a cell still gets one, clipped when drawn
+    m_grid.rows = std::max(1, m_height / (m_font_scale * m_glyph_properties.global_bbox_h));
+    m_grid.cols = std::max(1, m_width / (m_font_scale * m_glyph_properties.global_bbox_w));
+    m_grid.cells.assign(m_grid.rows * m_grid.cols, { ' ', 0 });
+    m_grid.row_hash.assign(m_grid.rows, NO_HASH);
+    for (int row = 0; row < m_grid.rows; ++row)
+        hashRow(row);
+    m_cursor_cell = SIZE_MAX;
+    // a new width moves where every visual line starts; keep to the same buffer row
+    m_wrap.setWidth(m_grid.cols);
+    m_top.segment = 0;
+    m_view.assign(m_grid.rows, NO_LINE);
+    m_line_bytes.resize(4 * m_grid.cols);
+    m_grid_dirty = true;
+}
+
+void
+yano::Yano::clearCursor()
+{
+    if (m_cursor_cell < m_grid.cells.size()) {
+        m_grid.cells[m_cursor_cell].attr &= ~ATTR_INVERSE;
+        hashRow(m_cursor_cell / m_grid.cols);
+    }
+    m_cursor_cell = SIZE_MAX;
+}
 
-        if (glyphFile.is_open()) {
-            std::string global_bbox_w, global_bbox_h, global_xoff, global_yoff;
-            std::string glyph_bbox_w, glyph_bbox_h, glyph_xoff, glyph_yoff;
+void
+yano::Yano::placeCursor()
+{
+    clearCursor();
 
-            glyphFile >> global_bbox_w >> global_bbox_h >> global_xoff >> global_yoff;
-            glyphFile >> glyph_bbox_w >> glyph_bbox_h >> glyph_xoff >> glyph_yoff;
+    int col;
+    VisualLine line = cursorLine(col);
+    int row = std::find(m_view.begin(), m_view.end(), line) - m_view.begin();
+    if (row >= m_grid.rows || col >= m_grid.cols) return;
+    if (m_prompt != PROMPT_NONE && row == m_grid.rows - 1) return;
+    if (overlayCovers(row, col)) return;
+    m_cursor_cell = row * m_grid.cols + col;
+    m_grid.cells[m_cursor_cell].attr |= ATTR_INVERSE;
+    hashRow(row);
+}
 
-            m_glyph_properties.global_bbox_w = std::stoi(global_bbox_w);
-            m_glyph_properties.global_bbox_h = std::stoi(global_bbox_h);
-            m_glyph_properties.global_xoff = std::stoi(global_xoff);
-            m_glyph_properties.global_yoff = std::stoi(global_yoff);
+void
+yano::Yano::publishFrame()
+{
+    placeCursor();
+    m_grid.cursor_row = m_text_buffer.m_cursor_position.row_coord;
+    m_grid.cursor_col = m_text_buffer.m_cursor_position.col_coord;
+    m_grid.font_scale = m_font_scale;
+    m_grid.width = m_width;
+    m_grid.height = m_height;
+    const uint32_t *palette = m_highlighter.palette();
+    for (uint32_t i = 0; i < ATTR_COLORS; ++i)
+        m_grid.palette[i] = (palette && i > 0) ? palette[i] : m_theme.foreground;
+    m_grid.background = m_theme.background;
+    m_grid.publish_time = Metrics::now();
+    if (m_input_time != 0) m_metrics.record(STAGE_LAYOUT, m_grid.publish_time - m_edit_time);
 
-            glyphFile.ignore(1000, '\n');
+    // a frame about to be replaced unread hands its keys on to this one
+    uint64_t input = m_input_time;
+    if (m_published_input != 0 && m_mailbox.pending())
+        input = (input == 0) ? m_published_input : std::min(input, m_published_input);
+    m_grid.input_time = input;
+    m_published_input = input;
+    m_input_time = 0;
+    m_mailbox.publish(m_grid);
+    m_grid_dirty = false;
+}
 
-            m_glyphs.push_back(std::vector<std::string>());
+void
+yano::Yano::renderFrame(const Frame &frame)
+{
+    // a new scale, palette, grid or window size invalidates every pixel
+    bool resized = frame.width != m_window->window_width || frame.height != m_window->window_height;
+    if (frame.font_scale != m_drawn_scale ||
+        memcmp(frame.palette, m_drawn_palette, sizeof(m_drawn_palette)) != 0 ||
+        frame.background != m_drawn_background ||
+        frame.cells.size() != m_shown.size() || resized) {
+        if (resized) m_window->resize(frame.width, frame.height);
+        m_drawn_scale = frame.font_scale;
+        memcpy(m_drawn_palette, frame.palette, sizeof(m_drawn_palette));
+        m_drawn_background = frame.background;
+        buildAtlas();
+        m_shown_top = frame.top;
+
+        if (m_window->hasGlyphs()) {
+            m_window->fillGlyphArea(0, 0, m_window->window_width, m_window->window_height,
+                                    m_drawn_background);
+        } else {
+            pw::fillRect((uint32_t *)m_window->drawable, m_window->stride,
+                         m_window->window_width, m_window->window_height, m_drawn_background);
+            m_window->damage(0, 0, m_window->window_width, m_window->window_height);
+        }
+        m_shown.assign(frame.cells.size(), { ' ', 0 });
+        m_shown_hash.assign(frame.rows, NO_HASH);
+    }
 
-            std::string bitline;
-            while (getline(glyphFile, bitline)) {
-                m_glyphs.back().push_back(bitline);
+    if (frame.top != m_shown_top) {
+        // rows still on screen move as pixels; only the rows scrolled in get drawn
+        int64_t delta = frame.top - m_shown_top;
+        int cell_h = m_drawn_scale * m_glyph_properties.global_bbox_h;
+        size_t row_cells = frame.cols;
+        if (std::abs(delta) < frame.rows) {
+            m_window->scroll(0, frame.rows * cell_h, -delta * cell_h);
+            int kept = frame.rows - std::abs(delta);
+            if (delta > 0) {
+                std::copy(m_shown.begin() + delta * row_cells, m_shown.end(), m_shown.begin());
+                std::fill(m_shown.begin() + kept * row_cells, m_shown.end(), NO_CELL);
+                std::copy(m_shown_hash.begin() + delta, m_shown_hash.end(), m_shown_hash.begin());
+                std::fill(m_shown_hash.begin() + kept, m_shown_hash.end(), NO_HASH);
+            } else {
+                std::copy_backward(m_shown.begin(), m_shown.begin() + kept * row_cells, m_shown.end());
+                std::fill(m_shown.begin(), m_shown.end() - kept * row_cells, NO_CELL);
+                std::copy_backward(m_shown_hash.begin(), m_shown_hash.begin() + kept, m_shown_hash.end());
+                std::fill(m_shown_hash.begin(), m_shown_hash.end() - kept, NO_HASH);
             }
+        } else {
+            std::fill(m_shown.begin(), m_shown.end(), NO_CELL);
+            std::fill(m_shown_hash.begin(), m_shown_hash.end(), NO_HASH);
+        }
+        m_shown_top = frame.top;
+    }
 
-            glyphFile.close();
+    for (int row = 0; row < frame.rows; ++row) {
+        if (frame.row_hash[row] == m_shown_hash[row]) continue;
+        const Cell *cells = &frame.cells[row * frame.cols];
+        Cell *shown = &m_shown[row * frame.cols];
+        for (int col = 0; col < frame.cols; ) {
+            if (cells[col] == shown[col]) {
+                ++col;
+                continue;
+            }
+            // changed cells in a row that share an attr are drawn together
+            int end = col + 1;
+            while (end < frame.cols && cells[end] != shown[end] && cells[end].attr == cells[col].attr)
+                ++end;
+            drawRun(row, col, cells + col, end - col);
+            std::copy(cells + col, cells + end, shown + col);
+            col = end;
         }
+        m_shown_hash[row] = frame.row_hash[row];
     }
 }
 
-yano::Yano::~Yano() {
-    delete(m_keycode_table);
-    delete(m_window);
+void
+yano::Yano::presentFrame(const Frame &frame)
+{
+    // queueing includes the wait for this refresh, which a key waits on too
+    uint64_t start = Metrics::now();
+    m_metrics.record(STAGE_QUEUE, start - frame.publish_time);
+    renderFrame(frame);
+    uint64_t drawn = Metrics::now();
+    pw::PresentTiming timing = m_window->present();
+    uint64_t flushed = Metrics::now();
+
+    m_metrics.record(STAGE_RASTER, drawn - start);
+    m_metrics.record(STAGE_UPLOAD, timing.upload_ns);
+    m_metrics.record(STAGE_FLUSH, timing.flush_ns);
+    m_metrics.record(STAGE_FRAME, flushed - start);
+    if (frame.input_time != 0)
+        m_metrics.record(STAGE_LATENCY, flushed - frame.input_time);
 }
 
-int
-yano::Yano::run() {
-    std::thread render(&yano::Yano::redraw, this);
+void
+yano::Yano::buildAtlas()
+{
+    int cell_w = m_drawn_scale * m_glyph_properties.global_bbox_w;
+    int cell_h = m_drawn_scale * m_glyph_properties.global_bbox_h;
 
-    while (!m_window->shouldClose()) {
-        xcb_keycode_t keycode;
-        uint32_t modifiers[4] = {0, 0, 0, 0}; // SHIFT, LOCK, CTRL, ALT
-        m_window->pollEvents(&keycode, modifiers);
-        keyHandler(keycode, modifiers);
+    // glyphs are rasterized on first use, so fonts with tens of thousands of
+    // glyphs only pay for the ones that appear on screen
+    if (m_window->hasGlyphs()) {
+        // colors are picked per run, so one upload per glyph serves every attr
+        m_window->resetGlyphs(cell_w, cell_h);
+        m_glyph_ids.assign(m_font.glyphCount(), -1);
+        m_glyph_count = 0;
+        for (uint32_t cp = ' '; cp < 127; ++cp)
+            glyphId(m_font.glyph(cp));
+        return;
+    }
+    m_atlas.clear();
+    m_atlas_slots.assign(m_font.glyphCount() * ATTR_COUNT, -1);
 
-        // draw cursor
-        //drawGlyph(m_text_buffer.m_cursor_position.row_coord,
-        //            m_text_buffer.m_cursor_position.col_coord,
-        //            m_font_scale,
-        //            ascii_char);
+    // printable ASCII is nearly always needed; do it up front
+    m_atlas.reserve(128 * cell_w * cell_h);
+    for (uint32_t cp = ' '; cp < 127; ++cp)
+        atlasSlot(m_font.glyph(cp), 0);
+}
+
+uint32_t
+yano::Yano::atlasSlot(uint32_t glyph, uint32_t attr)
+{
+    int32_t &entry = m_atlas_slots[glyph * ATTR_COUNT + attr];
+    if (entry >= 0) return entry;
+
+    int scale = m_drawn_scale;
+    int cell_w = scale * m_glyph_properties.global_bbox_w;
+    int cell_h = scale * m_glyph_properties.global_bbox_h;
+    uint32_t slot = m_atlas.size() / (cell_w * cell_h);
+    m_atlas.resize(m_atlas.size() + cell_w * cell_h);
+
+    uint32_t fg, bg;
+    cellColors(attr, fg, bg);
+    pw::MaskExpander expander(m_glyph_properties.global_bbox_w, scale);
+    expander.blit(&m_atlas[slot * cell_w * cell_h], cell_w, m_font.bitmap(glyph),
+                  m_glyph_properties.global_bbox_h, fg, bg);
+    entry = slot;
+    return slot;
+}
 
-        keycode = 0;
-        usleep(100000/m_refresh_rate);
+uint32_t
+yano::Yano::glyphId(uint32_t glyph)
+{
+    int32_t &entry = m_glyph_ids[glyph];
+    if (entry >= 0) return entry;
+
+    // expanded with full coverage as the foreground; the low byte of each pixel is it
+    int scale = m_drawn_scale;
+    int cell_w = scale * m_glyph_properties.global_bbox_w;
+    int cell_h = scale * m_glyph_properties.global_bbox_h;
+    m_coverage.resize(cell_w * cell_h);
+    pw::MaskExpander expander(m_glyph_properties.global_bbox_w, scale);
+    expander.blit(m_coverage.data(), cell_w, m_font.bitmap(glyph),
+                  m_glyph_properties.global_bbox_h, 0xff, 0x00);
+    uint8_t *bytes = (uint8_t *)m_coverage.data();    // packed in place, behind the reads
+    for (int i = 0; i < cell_w * cell_h; ++i)
+        bytes[i] = m_coverage[i];
+
+    entry = m_glyph_count++;
+    m_window->addGlyph(entry, bytes);
+    return entry;
+}
+
+void
+yano::Yano::drawRun(int row, int col, const Cell *cells, int count)
+{
+    if (!m_window->hasGlyphs()) {
+        for (int i = 0; i < count; ++i)
+            drawGlyph(row, col + i, cells[i]);
+        return;
     }
 
-    render.join();
+    // cells past the window's edge are left out, as drawGlyph() leaves them
+    int cell_w = m_drawn_scale * m_glyph_properties.global_bbox_w;
+    int cell_h = m_drawn_scale * m_glyph_properties.global_bbox_h;
+    if ((row + 1) * cell_h > m_window->window_height) return;
+    count = std::min(count, m_window->window_width / cell_w - col);
+    if (count <= 0) return;
 
-    return 0;
+    m_run_ids.resize(count);
+    for (int i = 0; i < count; ++i)
+        m_run_ids[i] = glyphId(m_font.glyph(cells[i].codepoint));
+    uint32_t fg, bg;
+    cellColors(cells[0].attr, fg, bg);
+    m_window->drawGlyphs(col * cell_w, row * cell_h, m_run_ids.data(), count, fg, bg);
+}
+
+void
+yano::Yano::drawText()
+{
+    // only the rows on screen are looked up, so only that much of a file gets indexed
+    invalidateGrid(0, m_grid.rows - 1);
+    layoutInvalid();
+}
+
+void
+yano::Yano::scrollTo(VisualLine top)
+{
+    if (top == m_top) return;
+    clearCursor();      // the mark would move with its row; publishFrame() places it again
+
+    // how many visual lines apart the two tops are, counting no further than a screen
+    PieceTable &text = m_text_buffer.m_text;
+    int rows = m_grid.rows;
+    int delta = rows;
+    VisualLine line = std::min(top, m_top);
+    VisualLine last = std::max(top, m_top);
+    for (int d = 1; d < rows; ++d) {
+        line = m_wrap.next(text, line);
+        if (line == last) {
+            delta = d;
+            break;
+        }
+    }
+    if (top < m_top) delta = -delta;
+
+    size_t row_cells = m_grid.cols;
+    if (std::abs(delta) < rows) {
+        // rows that stay visible keep their layout; lay out only the ones scrolled in
+        size_t kept = (rows - std::abs(delta)) * row_cells;
+        if (delta > 0) {
+            std::copy(m_grid.cells.begin() + delta * row_cells, m_grid.cells.end(), m_grid.cells.begin());
+            std::copy(m_grid.row_hash.begin() + delta, m_grid.row_hash.end(), m_grid.row_hash.begin());
+            std::copy(m_view.begin() + delta, m_view.end(), m_view.begin());
+            invalidateGrid(rows - delta, rows - 1);
+        } else {
+            std::copy_backward(m_grid.cells.begin(), m_grid.cells.begin() + kept, m_grid.cells.end());
+            std::copy_backward(m_grid.row_hash.begin(), m_grid.row_hash.begin() + rows + delta,
+                               m_grid.row_hash.end());
+            std::copy_backward(m_view.begin(), m_view.begin() + rows + delta, m_view.end());
+            invalidateGrid(0, -delta - 1);
+        }
+    } else {
+        invalidateGrid(0, rows - 1);
+    }
+    // the overlay moved with its rows; lay out again whatever it left behind
+    if (m_overlay) invalidateGrid(0, STAGE_COUNT + std::abs(delta));
+    m_top = top;
+    m_grid.top += delta;
+    m_grid_dirty = true;
+}
+
+void
+yano::Yano::followCursor()
+{
+    int col;
+    VisualLine cursor = cursorLine(col);
+    if (std::find(m_view.begin(), m_view.end(), cursor) != m_view.end()) return;
+    if (cursor < m_top) {
+        scrollTo(cursor);
+        return;
+    }
+    // below the screen: make it the last row
+    for (int row = 1; row < m_grid.rows; ++row)
+        cursor = m_wrap.prev(m_text_buffer.m_text, cursor);
+    scrollTo(cursor);
+}
+
+yano::VisualLine
+yano::Yano::cursorLine(int &col)
+{
+    PieceTable &text = m_text_buffer.m_text;
+    const TextBuffer::CursorPosition &cursor = m_text_buffer.m_cursor_position;
+    VisualLine line = { (uint64_t)cursor.row_coord, 0 };
+    m_wrap.locate(text, line.row, cursor.offset - text.lineStart(line.row), line.segment, col);
+    return line;
+}
+
+void
+yano::Yano::moveCursor(VisualLine line, int col)
+{
+    PieceTable &text = m_text_buffer.m_text;
+    uint64_t byte = m_wrap.byteAt(text, line.row, line.segment, col);
+    m_text_buffer.moveToKnown(text.lineStart(line.row) + byte, line.row,
+                              line.segment * m_wrap.width() + col);
+    m_grid_dirty = true;    // for the cursor mark, if nothing else changes
+}
+
+void
+yano::Yano::moveLines(int64_t lines)
+{
+    PieceTable &text = m_text_buffer.m_text;
+    int col;
+    VisualLine line = cursorLine(col);
+    if (m_goal_col < 0) m_goal_col = col;
+    for ( ; lines > 0; --lines) {
+        VisualLine next = m_wrap.next(text, line);
+        // looking the row up indexes far enough to tell whether it exists
+        if (next.row != line.row) {
+            text.lineStart(next.row);
+            if (next.row >= text.lineCount()) break;
+        }
+        line = next;
+    }
+    for ( ; lines < 0; ++lines)
+        line = m_wrap.prev(text, line);
+    moveCursor(line, m_goal_col);
+}
+
+void
+yano::Yano::moveToLineEdge(bool end)
+{
+    int col;
+    VisualLine line = cursorLine(col);
+    moveCursor(line, end ? INT_MAX : 0);
+}
+
+void
+yano::Yano::drawLine(int row)
+{
+    if (row < 0 || row >= m_grid.rows) return;
+    PieceTable &text = m_text_buffer.m_text;
+    uint64_t line = m_view[row].row;
+    Cell *cells = &m_grid.cells[row * m_grid.cols];
+    int col = 0;
+
+    // rows past the end of the text stay blank; a codepoint takes at most
+    // 4 bytes, so 4 * cols bytes always fill the row
+    uint64_t start = text.lineStart(line);
+    if (line == 0 || start != text.length()) {
+        // a row's colors are lexed from its start, so a wrapped part is read from there
+        // too, up to WRAP_COLOR_BYTES in
+        uint64_t skip = m_wrap.segmentStart(text, line, m_view[row].segment);
+        uint64_t lead = (skip <= WRAP_COLOR_BYTES) ? skip : 0;
+        m_line_bytes.resize(lead + 4 * m_grid.cols);
+        uint64_t n = text.read(start + skip - lead, m_line_bytes.data(), m_line_bytes.size());
+        const uint8_t *colors = (lead == skip) ? m_highlighter.colorLine(text, line, m_line_bytes.data(), n)
+                                               : nullptr;
+        uint64_t i = lead;
+        while (col < m_grid.cols && i < n && m_line_bytes[i] != '\n') {
+            uint32_t codepoint;
+            uint32_t attr = colors ? (uint32_t)colors[i] << ATTR_COLOR_SHIFT : 0;
+            i += utf8Decode(&m_line_bytes[i], n - i, &codepoint);
+            cells[col++] = { codepoint, attr };
+        }
+    }
+    std::fill(cells + col, cells + m_grid.cols, Cell{ ' ', 0 });
+    hashRow(row);
+    m_grid_dirty = true;
 }
 
 void
-yano::Yano::keyHandler(xcb_keycode_t keycode, uint32_t *modifiers) {
-    switch (keycode) {
-        case 0: break;
+yano::Yano::handleEvents()
+{
+    m_keys.clear();
+    m_window->pollEvents(m_keys);
+    uint64_t received = Metrics::now();
+    m_recorder.record(m_keys, received);
+
+    // a new window size lays the grid out again, as a new font scale does
+    uint16_t width, height;
+    m_window->configuredSize(width, height);
+    if (width != m_width || height != m_height) {
+        m_width = width;
+        m_height = height;
+        layoutGrid();
+        drawText();
+    }
+
+    // runs of plain characters become a single insert, however many keys arrived
+    for (const pw::KeyEvent &key : m_keys)
+        keyHandler(key);
+    flushTyped();
+
+    if (!m_keys.empty()) {
+        m_edit_time = Metrics::now();
+        m_metrics.record(STAGE_INPUT, m_edit_time - received);
+        if (m_input_time == 0) m_input_time = received;
+    }
+
+    if (m_window->shouldClose()) m_loop.stop();
+}
+
+void
+yano::Yano::flushTyped()
+{
+    if (m_typed.empty()) return;
+
+    int row = m_text_buffer.m_cursor_position.row_coord;
+    uint64_t lines = m_text_buffer.m_text.lineCount();
+    uint64_t byte = m_text_buffer.m_cursor_position.offset - m_text_buffer.m_text.lineStart(row);
+    m_text_buffer.addText(m_typed.data(), m_typed.size());
+    if (memchr(m_typed.data(), '\n', m_typed.size()) == NULL)
+        editedWithin(row, byte, 0, m_typed.size());
+    else
+        edited(row, row, lines);
+    m_typed.clear();
+}
+
+void
+yano::Yano::undo(bool redo)
+{
+    flushTyped();
+    PieceTable &text = m_text_buffer.m_text;
+    uint64_t first, last;
+    uint64_t lines = text.lineCount();
+    bool changed = redo ? m_text_buffer.redo(first, last) : m_text_buffer.undo(first, last);
+    if (!changed) return;
+    // the rows the group changed, numbered as before it for edited()
+    int first_row = text.rowOf(first);
+    int64_t last_row = (int64_t)text.rowOf(last) - ((int64_t)text.lineCount() - (int64_t)lines);
+    edited(first_row, (int)std::max<int64_t>(first_row, std::min<int64_t>(last_row, INT_MAX)), lines);
+}
+
+void
+yano::Yano::edited(int first, int last, uint64_t lines_before)
+{
+    // a change in the line count moves every row below
+    int64_t lines = (int64_t)m_text_buffer.m_text.lineCount() - (int64_t)lines_before;
+    m_wrap.edited(first, last, lines);
+    // the highlighter numbers the edited rows as they are now, rows the edit added
+    // included, so their placeholder states cannot pass for converged ones
+    int changed = (last == INT_MAX) ? INT_MAX : (int)std::min<int64_t>(last + std::max<int64_t>(lines, 0), INT_MAX);
+    int recolored = m_highlighter.edited(m_text_buffer.m_text, first, changed, lines);
+    invalidate(first, (lines != 0) ? INT_MAX : std::max(last, recolored));
+}
+
+void
+yano::Yano::editedWithin(int row, uint64_t byte, uint64_t erased, uint64_t inserted)
+{
+    m_wrap.editedWithin(m_text_buffer.m_text, row, byte, erased, inserted);
+    invalidate(row, std::max(row, m_highlighter.edited(m_text_buffer.m_text, row, row, 0)));
+}
+
+void
+yano::Yano::layoutInvalid()
+{
+    if (m_invalid_last < 0 && !m_view_stale) return;
+    PieceTable &text = m_text_buffer.m_text;
+    // an edit may have left the top row with fewer visual lines than it started on
+    m_top.segment = std::min(m_top.segment, m_wrap.lines(text, m_top.row) - 1);
+
+    // rows above the first invalid one show what they showed; with no NO_LINE rows in
+    // m_view, the walk starts there and ends once a row below the invalid ones shows
+    // its old line again, as all rows below it then do
+    int row = 0;
+    if (!m_view_stale)
+        while (row < m_grid.rows && (int64_t)m_view[row].row < m_invalid_first) ++row;
+    VisualLine line = (row == 0) ? m_top : VisualLine{ m_view[row < m_grid.rows ? row : 0].row, 0 };
+    for ( ; row < m_grid.rows; ++row) {
+        bool invalid = (int64_t)line.row >= m_invalid_first && (int64_t)line.row <= m_invalid_last;
+        if (!invalid && m_view[row] == line && !m_view_stale && (int64_t)line.row > m_invalid_last)
+            break;
+        if (invalid || !(m_view[row] == line)) {
+            m_view[row] = line;
+            drawLine(row);
+        }
+        line = m_wrap.next(text, line);
+    }
+    m_invalid_first = INT_MAX;
+    m_invalid_last = -1;
+    m_view_stale = false;
+}
+
+void
+yano::Yano::keyHandler(const pw::KeyEvent &key) {
+    bool shift = key.state & XCB_MOD_MASK_SHIFT;
+    bool ctrl = key.state & XCB_MOD_MASK_CONTROL;
+
+    if (key.keycode == F12) {
+        toggleOverlay();
+        return;
+    }
+    if (m_prompt != PROMPT_NONE) {
+        promptKey(key);
+        return;
+    }
+    if (key.keycode != UP && key.keycode != DOWN && key.keycode != PRIOR && key.keycode != NEXT)
+        m_goal_col = -1;
+
+    switch (key.keycode) {
         // backspace
         case BACKSPACE: {
+            flushTyped();
+            int row = m_text_buffer.m_cursor_position.row_coord;
+            uint64_t lines = m_text_buffer.m_text.lineCount();
+            uint64_t offset = m_text_buffer.m_cursor_position.offset;
             m_text_buffer.delChar();
-            drawGlyph(m_text_buffer.m_cursor_position.row_coord,
-                      m_text_buffer.m_cursor_position.col_coord,
-                      m_font_scale,
-                      0); // draw over with a null char
+            const TextBuffer::CursorPosition &cursor = m_text_buffer.m_cursor_position;
+            if (cursor.row_coord == row && cursor.offset < offset)
+                editedWithin(row, cursor.offset - m_text_buffer.m_text.lineStart(row), offset - cursor.offset, 0);
+            else
+                edited(cursor.row_coord, row, lines);
             break;
         }
+        // move the cursor and the view by a screen; cost scales with the rows scrolled in
+        case PRIOR:
+        case NEXT: {
+            flushTyped();
+            int page = (key.keycode == NEXT) ? m_grid.rows : -m_grid.rows;
+            moveLines(page);
+            VisualLine top = m_top;
+            for (int i = 0; i < m_grid.rows; ++i)
+                top = (page > 0) ? m_wrap.next(m_text_buffer.m_text, top) : m_wrap.prev(m_text_buffer.m_text, top);
+            // near the end of the text the cursor stops first; the view stops with it
+            int col;
+            scrollTo(std::min(top, cursorLine(col)));
+            break;
+        }
+        // move by visual lines, keeping to the column the first move started from
+        case UP:
+        case DOWN:
+            flushTyped();
+            moveLines((key.keycode == DOWN) ? 1 : -1);
+            break;
+        case HOME:
+        case END:
+            flushTyped();
+            moveToLineEdge(key.keycode == END);
+            break;
+        case UNDO:
+        case REDO:
+            undo(key.keycode == REDO);
+            break;
         default: {
-            char ascii_char = m_keycode_table->convert(keycode, modifiers[0] & 1);
-            m_text_buffer.addChar(ascii_char);
-            drawGlyph(m_text_buffer.m_cursor_position.row_coord,
-                      m_text_buffer.m_cursor_position.col_coord,
-                      m_font_scale,
-                      ascii_char);
+            // control shortcuts
+            if (ctrl) {
+                flushTyped();
+                if (key.keycode == S) saveFile();
+                else if (key.keycode == F) m_prompt = PROMPT_FIND;
+                else if (key.keycode == G) {
+                    m_prompt = PROMPT_GOTO;
+                    m_query.clear();
+                }
+                else if (key.keycode == Z) undo(shift);     // Ctrl+Shift+Z redoes
+                else if (key.keycode == Y) undo(true);
+                break;
+            }
+
+            char ascii_char = m_keycode_table->convert(key.keycode, shift);
+            if (ascii_char == 0) break;     // modifier or unmapped key
+            m_typed.push_back(ascii_char);
             break;
         }
     }
 }
 
-#endif
\ No newline at end of file
+void
+yano::Yano::promptKey(const pw::KeyEvent &key)
+{
+    bool shift = key.state & XCB_MOD_MASK_SHIFT;
+    bool ctrl = key.state & XCB_MOD_MASK_CONTROL;
+
+    if (ctrl) {
+        if (key.keycode == F || key.keycode == G) closePrompt();
+        return;
+    }
+    if (m_prompt == PROMPT_GOTO) {
+        if (key.keycode == RETURN && !m_query.empty()) {
+            gotoLine(std::stoll(m_query) - 1);
+        } else if (key.keycode == BACKSPACE) {
+            if (!m_query.empty()) m_query.pop_back();
+        } else {
+            char digit = m_keycode_table->convert(key.keycode, shift);
+            if (digit >= '0' && digit <= '9' && m_query.size() < 18) m_query.push_back(digit);
+        }
+        return;
+    }
+    if (key.keycode == RETURN) {
+        if (!m_matches.empty() || !m_search_done) {
+            // the next match after the current one, wrapping once the search is complete
+            m_jump_from = (m_match < m_matches.size()) ? m_matches[m_match].offset + 1 : 0;
+            m_jump_pending = true;
+            searchProgress();
+        } else {
+            startSearch();
+        }
+        return;
+    }
+
+    if (key.keycode == BACKSPACE) {
+        while (!m_query.empty() && utf8Continuation(m_query.back()))
+            m_query.pop_back();
+        if (!m_query.empty()) m_query.pop_back();
+    } else {
+        char ascii_char = m_keycode_table->convert(key.keycode, shift);
+        if (ascii_char == 0 || ascii_char == '\n') return;
+        m_query.push_back(ascii_char);
+    }
+    // a changed query makes the old matches meaningless
+    m_search.cancel();
+    m_matches.clear();
+    m_match = SIZE_MAX;
+    m_search_done = true;
+    m_jump_pending = false;
+}
+
+void
+yano::Yano::closePrompt()
+{
+    m_search.cancel();
+    m_matches.clear();
+    m_match = SIZE_MAX;
+    m_search_done = true;
+    m_jump_pending = false;
+    if (m_prompt == PROMPT_GOTO) m_query.clear();
+    m_prompt = PROMPT_NONE;
+    m_goto_pending = -1;
+    invalidateGrid(m_grid.rows - 1, m_grid.rows - 1);
+}
+
+void
+yano::Yano::startSearch()
+{
+    if (m_query.empty()) return;
+    bool regex = m_query[0] == '/';
+    std::string pattern = regex ? m_query.substr(1) : m_query;
+
+    m_matches.clear();
+    m_match = SIZE_MAX;
+    m_search_done = false;
+    int wakeup = m_search_wakeup;
+    if (!m_search.start(m_text_buffer.m_text, pattern, regex, [this, wakeup]() { m_loop.notify(wakeup); })) {
+        printf("Error: bad regex %s.\n", pattern.c_str());
+        m_search_done = true;
+        return;
+    }
+    m_jump_from = m_text_buffer.m_cursor_position.offset;
+    m_jump_pending = true;
+    searchProgress();
+}
+
+void
+yano::Yano::searchProgress()
+{
+    m_search_done = m_search.poll(m_matches);
+    if (!m_jump_pending) return;
+
+    // the first match at or past m_jump_from may not have streamed in yet
+    auto it = std::lower_bound(m_matches.begin(), m_matches.end(), m_jump_from,
+                               [](const Match &m, uint64_t offset) { return m.offset < offset; });
+    if (it != m_matches.end())
+        jumpToMatch(it - m_matches.begin());
+    else if (m_search_done && !m_matches.empty())
+        jumpToMatch(0);
+    else if (m_search_done)
+        m_jump_pending = false;
+}
+
+void
+yano::Yano::jumpToMatch(size_t i)
+{
+    m_match = i;
+    m_jump_pending = false;
+    m_text_buffer.moveToOffset(m_matches[i].offset);
+    m_text_buffer.m_undo.seal();
+}
+
+void
+yano::Yano::drawPrompt()
+{
+    int row = m_grid.rows - 1;
+    if (row < 0) return;
+    // the prompt covers any cursor mark on its row
+    if (m_cursor_cell < m_grid.cells.size() && m_cursor_cell / m_grid.cols == (size_t)row)
+        m_cursor_cell = SIZE_MAX;
+
+    char status[64] = "";
+    if (m_prompt == PROMPT_GOTO) {
+        // lines seen so far; the count only grows while the indexer runs
+        snprintf(status, sizeof(status), "   of %llu%s",
+                 (unsigned long long)m_text_buffer.m_text.lineCount(), m_indexing ? "+ (indexing)" : "");
+    } else if (!m_search_done || !m_matches.empty()) {
+        snprintf(status, sizeof(status), "   %zu/%zu%s",
+                 (m_match < m_matches.size()) ? m_match + 1 : 0, m_matches.size(),
+                 m_search_done ? "" : "...");
+    }
+    // no more of the query than fits on the row, however much was typed
+    int shown = (int)std::min<size_t>(m_query.size(), 4 * (size_t)m_grid.cols);
+    size_t capacity = shown + sizeof(status) + 8;
+    char *text = m_frame_arena.allocArray<char>(capacity);
+    size_t length = snprintf(text, capacity, "%s%.*s%s",
+                             (m_prompt == PROMPT_GOTO) ? "line: " : "find: ", shown, m_query.c_str(), status);
+    length = std::min(length, capacity - 1);
+
+    Cell *cells = &m_grid.cells[row * m_grid.cols];
+    Cell *line = m_frame_arena.allocArray<Cell>(m_grid.cols);
+    std::fill(line, line + m_grid.cols, Cell{ ' ', ATTR_INVERSE });
+    int col = 0;
+    for (size_t i = 0; col < m_grid.cols && i < length; ++col) {
+        uint32_t codepoint;
+        i += utf8Decode(&text[i], length - i, &codepoint);
+        line[col].codepoint = codepoint;
+    }
+    // republish only when the prompt actually changed
+    if (std::equal(line, line + m_grid.cols, cells)) return;
+    std::copy(line, line + m_grid.cols, cells);
+    hashRow(row);
+    m_grid_dirty = true;
+}
+
+void
+yano::Yano::toggleOverlay()
+{
+    m_overlay = !m_overlay;
+    if (m_overlay) {
+        refreshOverlay();
+        m_overlay_timer = m_loop.addTimer(std::chrono::milliseconds(500), true, [this]() { refreshOverlay(); });
+    } else {
+        m_loop.removeTimer(m_overlay_timer);
+        m_overlay_timer = -1;
+        invalidateGrid(0, STAGE_COUNT);
+    }
+}
+
+void
+yano::Yano::refreshOverlay()
+{
+    snprintf(m_overlay_text[0], sizeof(m_overlay_text[0]), "%s", Metrics::summaryHeader());
+    for (int s = 0; s < STAGE_COUNT; ++s)
+        m_metrics.summary((Stage)s, m_overlay_text[s + 1], sizeof(m_overlay_text[s + 1]));
+}
+
+void
+yano::Yano::drawOverlay()
+{
+    // the prompt keeps the last row
+    int rows = std::min<int>(STAGE_COUNT + 1, m_grid.rows - (m_prompt != PROMPT_NONE ? 1 : 0));
+    int first = std::max<int>(m_grid.cols - METRICS_LINE_WIDTH, 0);
+    // the overlay covers any cursor mark under it
+    if (m_cursor_cell < m_grid.cells.size() &&
+        overlayCovers(m_cursor_cell / m_grid.cols, m_cursor_cell % m_grid.cols))
+        m_cursor_cell = SIZE_MAX;
+
+    for (int row = 0; row < rows; ++row) {
+        const char *text = m_overlay_text[row];
+        Cell *cells = &m_grid.cells[row * m_grid.cols];
+        bool changed = false;
+        for (int col = first; col < m_grid.cols; ++col) {
+            Cell cell = { (uint32_t)(*text ? (uint8_t)*text++ : ' '), ATTR_INVERSE };
+            if (cells[col] == cell) continue;
+            cells[col] = cell;
+            changed = true;
+        }
+        // republish only when the numbers actually changed
+        if (!changed) continue;
+        hashRow(row);
+        m_grid_dirty = true;
+    }
+}
+
+void
+yano::Yano::startIndexer()
+{
+    int wakeup = m_index_wakeup;
+    m_indexer.start(m_text_buffer.m_text, [this, wakeup]() { m_loop.notify(wakeup); });
+    m_indexing = !m_text_buffer.m_text.fullyIndexed();
+}
+
+void
+yano::Yano::indexProgress()
+{
+    m_indexing = !m_indexer.drain(m_text_buffer.m_text);
+    // text appended while the thread ran was not among what it was given
+    if (!m_indexing && !m_text_buffer.m_text.fullyIndexed()) startIndexer();
+    if (m_goto_pending >= 0) gotoLine(m_goto_pending);
+}
+
+void
+yano::Yano::tailProgress()
+{
+    PieceTable &text = m_text_buffer.m_text;
+    uint64_t offset, length;
+    TailChange change = m_tail.check(offset, length);
+    if (change == TAIL_REPLACED) {
+        openFile(m_text_buffer.m_path);     // and follow it again from its end
+        return;
+    }
+    if (change == TAIL_NONE) return;
+
+    // a cursor on the last row keeps to it, and followCursor() scrolls the view along
+    const TextBuffer::CursorPosition &cursor = m_text_buffer.m_cursor_position;
+    bool at_bottom = text.fullyIndexed() && (uint64_t)cursor.row_coord + 1 == text.lineCount();
+    int last = (int)std::min<uint64_t>(text.lineCount() - 1, INT_MAX);
+    uint64_t appended = text.appendFrom(m_tail.fd(), offset, length);
+    m_tail.took(appended);
+    if (appended == 0) return;
+
+    // the old last row may have grown, and the rows after it are new; the states of
+    // rows that were already there stay right
+    m_wrap.edited(last, last, 0);
+    m_highlighter.grew();
+    invalidate(last, INT_MAX);
+    if (at_bottom) m_text_buffer.moveTo(INT_MAX, cursor.col_coord);
+    if (!m_indexing) startIndexer();
+    // more than one wakeup's worth; come back once input has had its turn
+    if (m_tail.behind()) m_loop.notify(m_tail_wakeup);
+}
+
+void
+yano::Yano::highlightProgress()
+{
+    int first, last;
+    if (m_highlighter.drain(first, last)) invalidate(first, last);
+}
+
+void
+yano::Yano::gotoLine(int64_t row)
+{
+    PieceTable &text = m_text_buffer.m_text;
+    row = std::max<int64_t>(row, 0);
+    // asking for a row the indexer has not reached would scan for it right here
+    if ((uint64_t)row >= text.lineCount() && m_indexing) {
+        m_goto_pending = row;
+        return;
+    }
+    m_text_buffer.moveTo(std::min<uint64_t>(row, INT_MAX), 0);
+    closePrompt();
+}
+
+#endif